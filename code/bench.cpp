@@ -0,0 +1,283 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_set>
+#include "problem.hpp"
+#include "model.hpp"
+#include "evaluator.hpp"
+#include "synthetic.hpp"
+#include "solver/altsvm.hpp"
+#include "solver/sgd.hpp"
+#include "solver/global.hpp"
+
+// Microbenchmarks of the hot kernels and end-to-end solver runs on synthetic data.
+// Every result is written as one JSON object per line.
+
+struct bench_configuration {
+  synthetic_option data;
+  int n_threads = 1, max_iter = 5, topk = 10, topk_users = 1000;
+  int hot_items = 0, hot_sync_every = 1000;     // per-thread replicas in solve_altsvm and solve_sgd
+  double lambda = 1000, alpha = 1e-2, beta = 1e-5;
+  double target = .5;             // time to reach f <= target * f(initial model)
+  std::string output = "bench_output.jsonl", only = "";
+};
+
+// expose the protected kernels of the solvers
+class BenchAltSVM : public SolverAltSVM {
+  public:
+    BenchAltSVM(int n_th) : SolverAltSVM(INIT_RANDOM, n_th) {}
+    void step_V(const Problem& prob, Model& model, double *alphaV, int idx, double C) { dcd_step_V(prob, model, alphaV, idx, C); }
+    void step_U(const Problem& prob, Model& model, double *alphaU, int idx, double C) { dcd_step_U(prob, model, alphaU, idx, C); }
+};
+
+class BenchSGD : public SolverSGD {
+  public:
+    BenchSGD(double alp, double bet, int n_th) : SolverSGD(alp, bet, STEP_SCHEDULE, INIT_RANDOM, n_th) {}
+    void setup(Problem& prob, Model& model) {
+      n_users = prob.n_users; n_items = prob.n_items; n_train_comps = prob.n_train_comps;
+      prepare(prob, model);
+    }
+    bool step(Model& model, const comparison& comp, loss_option_t loss_option, double l, double step_size) { return sgd_step(model, comp, loss_option, l, step_size); }
+    void fold(Model& model) { fold_scales(model); }
+};
+
+class BenchReport {
+  FILE *f;
+  const bench_configuration& conf;
+
+  public:
+    BenchReport(const bench_configuration& c) : conf(c) {
+      f = fopen(conf.output.c_str(), "w");
+      if (f == NULL) {
+        printf("Error in opening the benchmark output file!\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    ~BenchReport() { fclose(f); }
+
+    // n operations in sec seconds; extra is appended verbatim as additional JSON fields
+    void emit(const char* name, long long n, double sec, const std::string& extra = "") {
+      fprintf(f, "{\"bench\": \"%s\", \"users\": %d, \"items\": %d, \"comps_per_user\": %d, \"rank\": %d, \"threads\": %d, "
+                 "\"n\": %lld, \"seconds\": %.6f, \"per_sec\": %.1f%s}\n",
+              name, conf.data.n_users, conf.data.n_items, conf.data.comps_per_user, conf.data.rank, conf.n_threads,
+              n, sec, (sec > 0.) ? (double)n / sec : 0., extra.c_str());
+      fflush(f);
+      printf("%-16s %12lld ops %10.4f sec %14.1f ops/sec\n", name, n, sec, (sec > 0.) ? (double)n / sec : 0.);
+    }
+};
+
+void random_model(Model& model, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> unif(0., 1. / sqrt((double)model.rank));
+  for(long long i=0; i<(long long)model.n_users*model.rank; ++i) model.U[i] = unif(gen);
+  for(long long i=0; i<(long long)model.n_items*model.rank; ++i) model.V[i] = unif(gen);
+}
+
+// only : comma-separated list of benchmark groups to run (all if empty)
+bool selected(const bench_configuration& conf, const std::string& name) {
+  if (conf.only.length() == 0) return true;
+  std::stringstream ss(conf.only);
+  std::string token;
+  while (std::getline(ss, token, ',')) if (token == name) return true;
+  return false;
+}
+
+void bench_dcd(Problem& prob, const bench_configuration& conf, BenchReport& out) {
+  Model model(prob.n_users, prob.n_items, conf.data.rank);
+  random_model(model, conf.data.seed);
+
+  BenchAltSVM solver(conf.n_threads);
+  solver.set_objective(prob.loss_option, conf.lambda);
+  std::vector<double> alpha(prob.n_train_comps, 0.);
+  int n_max_updates = prob.n_train_comps / conf.n_threads;
+
+  double time = omp_get_wtime();
+  #pragma omp parallel
+  {
+    std::mt19937 gen(omp_get_thread_num());
+    std::uniform_int_distribution<int> randidx(0, prob.n_train_comps-1);
+    for(int n=0; n<n_max_updates; ++n) solver.step_V(prob, model, alpha.data(), randidx(gen), 1./conf.lambda);
+  }
+  out.emit("dcd_update_V", (long long)n_max_updates * conf.n_threads, omp_get_wtime() - time);
+
+  std::fill(alpha.begin(), alpha.end(), 0.);
+  time = omp_get_wtime();
+  #pragma omp parallel
+  {
+    int i_thread = omp_get_thread_num();
+    int uid_from = (prob.n_users * i_thread / conf.n_threads);
+    int uid_to   = (prob.n_users * (i_thread+1) / conf.n_threads);
+    std::mt19937 gen(i_thread);
+    std::uniform_int_distribution<int> randidx(prob.tridx[uid_from], prob.tridx[uid_to]-1);
+    for(int n=0; n<n_max_updates; ++n) solver.step_U(prob, model, alpha.data(), randidx(gen), 1./conf.lambda);
+  }
+  out.emit("dcd_update_U", (long long)n_max_updates * conf.n_threads, omp_get_wtime() - time);
+}
+
+void bench_sgd(Problem& prob, const bench_configuration& conf, BenchReport& out) {
+  Model model(prob.n_users, prob.n_items, conf.data.rank);
+  random_model(model, conf.data.seed);
+
+  BenchSGD solver(conf.alpha, conf.beta, conf.n_threads);
+  solver.setup(prob, model);
+  int n_max_updates = prob.n_train_comps / conf.n_threads;
+
+  double time = omp_get_wtime();
+  #pragma omp parallel
+  {
+    std::mt19937 gen(omp_get_thread_num());
+    std::uniform_int_distribution<int> randidx(0, prob.n_train_comps-1);
+    for(int n=0; n<n_max_updates; ++n) solver.step(model, prob.train[randidx(gen)], prob.loss_option, prob.lambda, conf.alpha);
+  }
+  solver.fold(model);
+  out.emit("sgd_step", (long long)n_max_updates * conf.n_threads, omp_get_wtime() - time);
+}
+
+void bench_loss(Problem& prob, const bench_configuration& conf, BenchReport& out) {
+  Model model(prob.n_users, prob.n_items, conf.data.rank);
+  random_model(model, conf.data.seed);
+
+  int n_repeat = 3;
+  double time = omp_get_wtime(), f = 0.;
+  for(int r=0; r<n_repeat; ++r) f += compute_loss(model, prob.train, prob.loss_option);
+  out.emit("compute_loss", (long long)n_repeat * prob.n_train_comps, omp_get_wtime() - time);
+}
+
+void bench_topk(Problem& prob, const bench_configuration& conf, BenchReport& out) {
+  Model model(prob.n_users, prob.n_items, conf.data.rank);
+  random_model(model, conf.data.seed);
+
+  // items compared by a user are excluded from its recommendations
+  int n_users = std::min(conf.topk_users, prob.n_users);
+  std::vector<std::unordered_set<int> > seen(n_users);
+  for(int uid=0; uid<n_users; ++uid) {
+    for(int i=prob.tridx[uid]; i<prob.tridx[uid+1]; ++i) {
+      seen[uid].insert(prob.train[i].item1_id);
+      seen[uid].insert(prob.train[i].item2_id);
+    }
+  }
+
+  double time = omp_get_wtime();
+  #pragma omp parallel for schedule(dynamic)
+  for(int uid=0; uid<n_users; ++uid) {
+    topk_queue pq;
+    score_topk(model, uid, conf.topk, seen[uid], pq);
+  }
+  out.emit("topk_scoring", n_users, omp_get_wtime() - time, ", \"k\": " + std::to_string(conf.topk));
+}
+
+void bench_read(Problem& prob, const bench_configuration& conf, BenchReport& out) {
+  std::string filename = conf.output + ".comps.tmp";
+  prob.write_data(filename);
+
+  Problem loaded;
+  double time = omp_get_wtime();
+  loaded.read_data(filename);
+  out.emit("read_data", loaded.n_train_comps, omp_get_wtime() - time);
+
+  remove(filename.c_str());
+}
+
+void bench_solver(const char* name, Solver* solver, Problem& prob, const bench_configuration& conf, BenchReport& out) {
+  Model model(prob.n_users, prob.n_items, conf.data.rank);
+  solver->solve(prob, model, NULL);
+
+  const std::vector<trace_point>& trace = solver->trace;
+  if (trace.size() == 0) return;
+
+  // time to the first reported iterate with f <= target * f(initial model)
+  std::string time_to_target = "null";
+  for(int i=1; i<trace.size(); ++i) {
+    if (trace[i].f <= conf.target * trace[0].f) {
+      time_to_target = std::to_string(trace[i].time);
+      break;
+    }
+  }
+
+  char extra[256];
+  snprintf(extra, sizeof(extra), ", \"iterations\": %d, \"f_initial\": %.6e, \"f_final\": %.6e, \"target\": %g, \"time_to_target\": %s",
+           trace.back().iter, trace[0].f, trace.back().f, conf.target, time_to_target.c_str());
+  out.emit(name, trace.back().n_updates, trace.back().time, extra);
+}
+
+int readArgs(bench_configuration& conf, int argc, char* argv[]) {
+  for(int i=1; i<argc; ++i) {
+    std::string arg(argv[i]);
+    size_t pos = arg.find('=');
+    if (pos == std::string::npos) return 0;
+
+    std::string key = arg.substr(0, pos), val = arg.substr(pos+1);
+    if (key == "users") conf.data.n_users = std::stoi(val);
+    else if (key == "items") conf.data.n_items = std::stoi(val);
+    else if (key == "comps") conf.data.comps_per_user = std::stoi(val);
+    else if (key == "rank") conf.data.rank = std::stoi(val);
+    else if (key == "user_exponent") conf.data.user_exponent = std::stod(val);
+    else if (key == "item_exponent") conf.data.item_exponent = std::stod(val);
+    else if (key == "seed") conf.data.seed = std::stoi(val);
+    else if (key == "threads") conf.n_threads = std::stoi(val);
+    else if (key == "iter") conf.max_iter = std::stoi(val);
+    else if (key == "lambda") conf.lambda = std::stod(val);
+    else if (key == "alpha") conf.alpha = std::stod(val);
+    else if (key == "beta") conf.beta = std::stod(val);
+    else if (key == "target") conf.target = std::stod(val);
+    else if (key == "topk") conf.topk = std::stoi(val);
+    else if (key == "topk_users") conf.topk_users = std::stoi(val);
+    else if (key == "hot_items") conf.hot_items = std::stoi(val);
+    else if (key == "hot_sync_every") conf.hot_sync_every = std::stoi(val);
+    else if (key == "only") conf.only = val;
+    else if (key == "output") conf.output = val;
+    else return 0;
+  }
+  return 1;
+}
+
+int main (int argc, char* argv[]) {
+  bench_configuration conf;
+
+  if (!readArgs(conf, argc, argv)) {
+    std::cerr << "Usage : " << std::string(argv[0]) << " [key=value ...]" << std::endl;
+    std::cerr << "  keys : users, items, comps, rank, user_exponent, item_exponent, seed, threads, iter," << std::endl;
+    std::cerr << "         lambda, alpha, beta, target, topk, topk_users, hot_items, hot_sync_every, only, output" << std::endl;
+    return -1;
+  }
+
+  omp_set_dynamic(0);
+  omp_set_num_threads(conf.n_threads);
+
+  Problem prob(L2_HINGE, conf.lambda);
+
+  double time = omp_get_wtime();
+  generate_comparisons(conf.data, prob);
+  printf("Synthetic data : %d users, %d items, %d comparisons (%f sec)\n", prob.n_users, prob.n_items, prob.n_train_comps, omp_get_wtime() - time);
+
+  BenchReport out(conf);
+
+  if (selected(conf, "dcd"))  bench_dcd(prob, conf, out);
+  if (selected(conf, "sgd"))  bench_sgd(prob, conf, out);
+  if (selected(conf, "loss")) bench_loss(prob, conf, out);
+  if (selected(conf, "topk")) bench_topk(prob, conf, out);
+  if (selected(conf, "read")) bench_read(prob, conf, out);
+
+  if (selected(conf, "solve_altsvm")) {
+    SolverAltSVM solver(INIT_RANDOM, conf.n_threads, conf.max_iter);
+    solver.set_hot_items(conf.hot_items, conf.hot_sync_every, MERGE_SUM);
+    bench_solver("solve_altsvm", &solver, prob, conf, out);
+  }
+  if (selected(conf, "solve_sgd")) {
+    SolverSGD solver(conf.alpha, conf.beta, STEP_SCHEDULE, INIT_RANDOM, conf.n_threads, conf.max_iter);
+    solver.set_hot_items(conf.hot_items, conf.hot_sync_every, MERGE_SUM);
+    bench_solver("solve_sgd", &solver, prob, conf, out);
+  }
+  if (selected(conf, "solve_global")) {
+    SolverGlobal solver(INIT_RANDOM, conf.n_threads, conf.max_iter);
+    bench_solver("solve_global", &solver, prob, conf, out);
+  }
+
+  return 0;
+}
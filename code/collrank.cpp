@@ -5,22 +5,104 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <sstream>
+#include <thread>
+#include <chrono>
 #include "problem.hpp"
 #include "model.hpp"
 #include "evaluator.hpp"
+#include "ingest.hpp"
+#include "metrics.hpp"
 #include "solver/altsvm.hpp"
 #include "solver/sgd.hpp"
 #include "solver/global.hpp"
+#include "solver/alsrank.hpp"
+#include "solver/altsvm_ooc.hpp"
+#include "solver/altsvm_incremental.hpp"
+#include "shards.hpp"
+#include "quantize.hpp"
+#include "scoring.hpp"
 
 struct configuration {
   std::string algo = "alt_svm", loss = "l2hinge";
-  std::string type_str = "numeric", train_comps_file, train_file, test_file = "", model_file = "", model_output = "";
+  std::string type_str = "numeric", train_comps_file, train_file, test_file = "", model_file = "", model_output = "", metrics_output = "";
   int rank = 10, n_threads = 1, max_iter = 10;
   double lambda = 1000, tol = 1e-5;
   double alpha, beta;
+  std::string stepsize = "schedule";
+  std::string init = "random";
+  unsigned init_seed = 1;
+  std::string ratings_file = "", ingest_output = "";
+  ingest_option ingest;
+  int max_comps_per_user = 0, max_comps_per_pair = 0;
+  std::vector<int> ndcg_k = std::vector<int>(1, 10);
   bool evaluate_every_iter = true;
+  int eval_sample_users = 0, eval_full_every = 0;
+  unsigned eval_seed = 1;
+  int hot_items = 0, hot_sync_every = 1000;
+  std::string hot_merge = "sum";
+  double validation_frac = 0.;
+  int patience = 0;
+  bool adaptive_sweeps = false;
+  double gap_factor = .1;
+  int max_inner_sweeps = 10;
+  long long gap_sample = 100000;
+  std::string u_solver = "dcd", v_solver = "dcd";
+  int newton_iters = 5, cg_iters = 20;
+  double newton_eps = 1e-3;
+  int als_cg_iters = 10;
+  double als_cg_eps = 1e-3;
+
+  // implicit feedback : positives of train_rating_file, negatives sampled during training
+  bool implicit = false;
+  std::string negative_sampling = "uniform";
+  int negatives_per_positive = 1;
+
+  // out-of-core training : comparisons streamed from disk shards
+  bool out_of_core = false;
+  std::string shard_prefix = "";
+  long long shard_comps = 1000000;
+  int shard_buffers = 2;
+
+  // file-backed factors : V (and U) mapped from paged_model.V (.U) with a bounded working set
+  std::string paged_model = "";
+  bool paged_users = false;
+  int paged_working_set_mb = 1024, paged_chunk_kb = 1024, paged_batch = 512;
+
+  // post-training quantization : schemes, export prefix and top-K recall against the exact scan
+  std::vector<std::string> quantize;
+  std::string quantize_output = "";
+  int quantize_topk = 10, quantize_shortlist = 100, quantize_users = 0;
+
+  // recommend mode : top-K lists of model_file for all users or the users listed in recommend_users
+  std::string mode = "train";
+  int model_users = 0, model_items = 0;
+  int recommend_k = 10, recommend_block = 64, recommend_tile = 1024;
+  std::string recommend_users = "", recommend_seen = "", recommend_output = "", recommend_format = "tsv";
+
+  // dual state of altsvm (written in train mode, read and rewritten in incremental mode) and
+  // incremental training on the comparisons appended to incremental_file
+  std::string state_file = "", incremental_file = "";
+  int incremental_sweeps = 3, refresh_iters = 1;
+  bool follow = false;
+  int follow_poll_sec = 60, follow_rounds = 0;
+
+  // sweep mode : every combination of the listed values, on one loaded problem
+  std::vector<std::string> sweep_loss;
+  std::vector<int> sweep_rank;
+  std::vector<double> sweep_lambda;
+  int sweep_parallel = 1;
+  std::string sweep_output = "";
 };
 
+std::vector<std::string> split_list(const std::string& val) {
+  std::vector<std::string> items;
+  std::stringstream ss(val);
+  std::string item;
+  while (std::getline(ss, item, ',')) items.push_back(item);
+  return items;
+}
+
 int readConf(struct configuration& conf, std::string conFile) {
 
   std::ifstream infile(conFile);
@@ -43,6 +125,36 @@ int readConf(struct configuration& conf, std::string conFile) {
       if (key == "train_file") {
         conf.train_comps_file = val;
       }
+      if (key == "ratings_file") {
+        conf.ratings_file = val;
+      }
+      if (key == "train_items") {
+        conf.ingest.n_train = std::stoi(val);
+      }
+      if (key == "test_items") {
+        conf.ingest.n_test = std::stoi(val);
+      }
+      if (key == "train_frac") {
+        conf.ingest.f_train = std::stod(val);
+      }
+      if (key == "test_frac") {
+        conf.ingest.f_test = std::stod(val);
+      }
+      if (key == "comps_per_user") {
+        conf.ingest.n_comps = std::stoi(val);
+      }
+      if (key == "split_seed") {
+        conf.ingest.seed = std::stoul(val);
+      }
+      if (key == "max_comps_per_user") {
+        conf.max_comps_per_user = std::stoi(val);
+      }
+      if (key == "max_comps_per_pair") {
+        conf.max_comps_per_pair = std::stoi(val);
+      }
+      if (key == "ingest_output") {
+        conf.ingest_output = val;
+      }
       if (key == "train_rating_file") {
         conf.train_file = val;
       }
@@ -67,9 +179,199 @@ int readConf(struct configuration& conf, std::string conFile) {
       if (key == "tol") {
         conf.tol = std::stod(val);
       }
+      if (key == "hot_items") {
+        conf.hot_items = std::stoi(val);
+      }
+      if (key == "hot_sync_every") {
+        conf.hot_sync_every = std::stoi(val);
+      }
+      if (key == "hot_merge") {
+        conf.hot_merge = val;
+      }
+      if (key == "validation_frac") {
+        conf.validation_frac = std::stod(val);
+      }
+      if (key == "patience") {
+        conf.patience = std::stoi(val);
+      }
+      if (key == "adaptive_sweeps") {
+        if ((val == "true") || (val == "1")) conf.adaptive_sweeps = true;
+        if ((val == "false") || (val == "0")) conf.adaptive_sweeps = false;
+      }
+      if (key == "gap_factor") {
+        conf.gap_factor = std::stod(val);
+      }
+      if (key == "max_inner_sweeps") {
+        conf.max_inner_sweeps = std::stoi(val);
+      }
+      if (key == "gap_sample") {
+        conf.gap_sample = std::stoll(val);
+      }
+      if (key == "u_solver") {
+        conf.u_solver = val;
+      }
+      if (key == "v_solver") {
+        conf.v_solver = val;
+      }
+      if (key == "newton_iters") {
+        conf.newton_iters = std::stoi(val);
+      }
+      if (key == "cg_iters") {
+        conf.cg_iters = std::stoi(val);
+      }
+      if (key == "newton_eps") {
+        conf.newton_eps = std::stod(val);
+      }
+      if (key == "als_cg_iters") {
+        conf.als_cg_iters = std::stoi(val);
+      }
+      if (key == "als_cg_eps") {
+        conf.als_cg_eps = std::stod(val);
+      }
+      if (key == "implicit") {
+        if ((val == "true") || (val == "1")) conf.implicit = true;
+        if ((val == "false") || (val == "0")) conf.implicit = false;
+      }
+      if (key == "negative_sampling") {
+        conf.negative_sampling = val;
+      }
+      if (key == "negatives_per_positive") {
+        conf.negatives_per_positive = std::stoi(val);
+      }
+      if (key == "out_of_core") {
+        if ((val == "true") || (val == "1")) conf.out_of_core = true;
+        if ((val == "false") || (val == "0")) conf.out_of_core = false;
+      }
+      if (key == "shard_prefix") {
+        conf.shard_prefix = val;
+      }
+      if (key == "shard_comps") {
+        conf.shard_comps = std::stoll(val);
+      }
+      if (key == "shard_buffers") {
+        conf.shard_buffers = std::stoi(val);
+      }
+      if (key == "paged_model") {
+        conf.paged_model = val;
+      }
+      if (key == "paged_users") {
+        if ((val == "true") || (val == "1")) conf.paged_users = true;
+        if ((val == "false") || (val == "0")) conf.paged_users = false;
+      }
+      if (key == "paged_working_set_mb") {
+        conf.paged_working_set_mb = std::stoi(val);
+      }
+      if (key == "paged_chunk_kb") {
+        conf.paged_chunk_kb = std::stoi(val);
+      }
+      if (key == "paged_batch") {
+        conf.paged_batch = std::stoi(val);
+      }
+      if (key == "quantize") {
+        conf.quantize = split_list(val);
+      }
+      if (key == "quantize_output") {
+        conf.quantize_output = val;
+      }
+      if (key == "quantize_topk") {
+        conf.quantize_topk = std::stoi(val);
+      }
+      if (key == "quantize_shortlist") {
+        conf.quantize_shortlist = std::stoi(val);
+      }
+      if (key == "quantize_users") {
+        conf.quantize_users = std::stoi(val);
+      }
+      if (key == "model_file") {
+        conf.model_file = val;
+      }
+      if (key == "mode") {
+        conf.mode = val;
+      }
+      if (key == "model_users") {
+        conf.model_users = std::stoi(val);
+      }
+      if (key == "model_items") {
+        conf.model_items = std::stoi(val);
+      }
+      if (key == "recommend_k") {
+        conf.recommend_k = std::stoi(val);
+      }
+      if (key == "recommend_block") {
+        conf.recommend_block = std::stoi(val);
+      }
+      if (key == "recommend_tile") {
+        conf.recommend_tile = std::stoi(val);
+      }
+      if (key == "recommend_users") {
+        conf.recommend_users = val;
+      }
+      if (key == "recommend_seen") {
+        conf.recommend_seen = val;
+      }
+      if (key == "recommend_output") {
+        conf.recommend_output = val;
+      }
+      if (key == "recommend_format") {
+        conf.recommend_format = val;
+      }
+      if (key == "state_file") {
+        conf.state_file = val;
+      }
+      if (key == "incremental_file") {
+        conf.incremental_file = val;
+      }
+      if (key == "incremental_sweeps") {
+        conf.incremental_sweeps = std::stoi(val);
+      }
+      if (key == "refresh_iters") {
+        conf.refresh_iters = std::stoi(val);
+      }
+      if (key == "follow") {
+        if ((val == "true") || (val == "1")) conf.follow = true;
+        if ((val == "false") || (val == "0")) conf.follow = false;
+      }
+      if (key == "follow_poll_sec") {
+        conf.follow_poll_sec = std::stoi(val);
+      }
+      if (key == "follow_rounds") {
+        conf.follow_rounds = std::stoi(val);
+      }
       if (key == "evaluate") {
-        if (val == "true") conf.evaluate_every_iter = true;
-        if (val == "false") conf.evaluate_every_iter = false;
+        if ((val == "true") || (val == "1")) conf.evaluate_every_iter = true;
+        if ((val == "false") || (val == "0")) conf.evaluate_every_iter = false;
+      }
+      if (key == "eval_sample_users") {
+        conf.eval_sample_users = std::stoi(val);
+      }
+      if (key == "eval_full_every") {
+        conf.eval_full_every = std::stoi(val);
+      }
+      if (key == "eval_seed") {
+        conf.eval_seed = std::stoul(val);
+      }
+      if (key == "ndcg_k") {
+        // comma-separated list of cutoffs
+        std::vector<std::string> items = split_list(val);
+        conf.ndcg_k.clear();
+        for(int i=0; i<items.size(); ++i) conf.ndcg_k.push_back(std::stoi(items[i]));
+      }
+      if (key == "sweep_loss") {
+        conf.sweep_loss = split_list(val);
+      }
+      if (key == "sweep_rank") {
+        std::vector<std::string> items = split_list(val);
+        for(int i=0; i<items.size(); ++i) conf.sweep_rank.push_back(std::stoi(items[i]));
+      }
+      if (key == "sweep_lambda") {
+        std::vector<std::string> items = split_list(val);
+        for(int i=0; i<items.size(); ++i) conf.sweep_lambda.push_back(std::stod(items[i]));
+      }
+      if (key == "sweep_parallel") {
+        conf.sweep_parallel = std::stoi(val);
+      }
+      if (key == "sweep_output") {
+        conf.sweep_output = val;
       }
       if (key == "nthreads") {
         conf.n_threads = std::stoi(val);
@@ -80,15 +382,484 @@ int readConf(struct configuration& conf, std::string conFile) {
       if (key == "stepsize_beta") {
         conf.beta = std::stod(val);
       }
+      if (key == "init") {
+        conf.init = val;
+      }
+      if (key == "init_seed") {
+        conf.init_seed = std::stoul(val);
+      }
+      if (key == "stepsize") {
+        conf.stepsize = val;
+      }
       if (key == "model_output") {
         conf.model_output = val;
       }
+      if (key == "metrics_output") {
+        conf.metrics_output = val;
+      }
     }
   }
 
   return 1;
 }
 
+bool parse_loss(const std::string& loss, loss_option_t& option) {
+  if (loss == "l1hinge")
+    option = L1_HINGE;
+  else if (loss == "l2hinge")
+    option = L2_HINGE;
+  else if (loss == "logistic")
+    option = LOGISTIC;
+  else if (loss == "squared")
+    option = SQUARED;
+  else
+    return false;
+  return true;
+}
+
+bool parse_subsolver(const std::string& name, subsolver_option_t& option) {
+  if (name == "dcd")
+    option = SUBSOLVER_DCD;
+  else if (name == "newton")
+    option = SUBSOLVER_NEWTON;
+  else
+    return false;
+  return true;
+}
+
+// solver of conf.algo, NULL (with an error message) for an unknown algorithm or stepsize option,
+// or a loss the algorithm does not support
+Solver* make_solver(const configuration& conf, init_option_t init_option, int n_threads, bool verbose) {
+  Solver* mySolver = NULL;
+
+  if (conf.algo == "altsvm") {
+    if (verbose) printf("AltSVM with %d threads..\n", n_threads);
+    subsolver_option_t u_solver, v_solver;
+    if (!parse_subsolver(conf.u_solver, u_solver) || !parse_subsolver(conf.v_solver, v_solver)) {
+      std::cerr << "ERROR : provide correct u_solver / v_solver option !\n";
+      return NULL;
+    }
+    NewtonOptions newton;
+    newton.max_iter = conf.newton_iters;
+    newton.max_cg   = conf.cg_iters;
+    newton.eps      = conf.newton_eps;
+
+    SolverAltSVM *altsvm = new SolverAltSVM(init_option, n_threads, conf.max_iter);
+    altsvm->set_adaptive_sweeps(conf.adaptive_sweeps, conf.gap_factor, conf.max_inner_sweeps, conf.gap_sample);
+    altsvm->set_subsolvers(u_solver, v_solver, newton);
+    mySolver = altsvm;
+  }
+  else if (conf.algo == "sgd") {
+    stepsize_option_t stepsize_option;
+    if (conf.stepsize == "schedule")
+      stepsize_option = STEP_SCHEDULE;
+    else if (conf.stepsize == "adagrad")
+      stepsize_option = STEP_ADAGRAD;
+    else if (conf.stepsize == "rmsprop")
+      stepsize_option = STEP_RMSPROP;
+    else if (conf.stepsize == "adam")
+      stepsize_option = STEP_ADAM;
+    else {
+      std::cerr << "ERROR : provide correct stepsize option !\n";
+      return NULL;
+    }
+
+    if (verbose) printf("SGD with %d threads.. \n", n_threads);
+    mySolver = new SolverSGD(conf.alpha, conf.beta, stepsize_option, init_option, n_threads, conf.max_iter);
+  }
+  else if (conf.algo == "alsrank") {
+    loss_option_t option;
+    if (!parse_loss(conf.loss, option) || (option != SQUARED)) {
+      std::cerr << "ERROR : alsrank needs the squared loss !\n";
+      return NULL;
+    }
+    if (verbose) printf("ALS on the squared loss with %d threads..\n", n_threads);
+    mySolver = new SolverALSRank(init_option, n_threads, conf.max_iter, conf.als_cg_iters, conf.als_cg_eps);
+  }
+  else if (conf.algo == "global") {
+    if (verbose) printf("Global ranking with all-aggregated comparisons.. \n");
+    mySolver = new SolverGlobal(init_option, n_threads, conf.max_iter);
+  }
+  else {
+    std::cerr << "ERROR : provide correct algorithm !\n";
+    return NULL;
+  }
+
+  mySolver->set_stopping(conf.tol, conf.patience);
+  mySolver->set_seed(conf.init_seed);
+
+  if ((conf.hot_merge != "sum") && (conf.hot_merge != "average")) {
+    std::cerr << "ERROR : provide correct hot_merge option !\n";
+    delete mySolver;
+    return NULL;
+  }
+  mySolver->set_hot_items(conf.hot_items, conf.hot_sync_every, (conf.hot_merge == "average") ? MERGE_AVERAGE : MERGE_SUM);
+
+  return mySolver;
+}
+
+// Train every (loss, rank, lambda) combination of the sweep lists on the loaded problem and
+// print one row per combination. Each (loss, rank) pair walks its lambda path from the largest
+// value down, warm-starting from the previous model (and duals for altsvm); sweep_parallel
+// paths run concurrently, each with n_threads / sweep_parallel threads.
+int run_sweep(const configuration& conf, init_option_t init_option, Problem& prob, Evaluator* eval, const std::string& metric_columns) {
+
+  std::vector<std::string> losses = conf.sweep_loss.empty() ? std::vector<std::string>(1, conf.loss) : conf.sweep_loss;
+  std::vector<int> ranks          = conf.sweep_rank.empty() ? std::vector<int>(1, conf.rank) : conf.sweep_rank;
+  std::vector<double> lambdas     = conf.sweep_lambda.empty() ? std::vector<double>(1, conf.lambda) : conf.sweep_lambda;
+  std::sort(lambdas.begin(), lambdas.end(), std::greater<double>());
+
+  std::vector<std::pair<int,int> > paths;     // (index into losses, rank)
+  for(int l=0; l<losses.size(); ++l) {
+    loss_option_t option;
+    if (!parse_loss(losses[l], option)) {
+      std::cerr << "ERROR : provide correct loss function !\n";
+      return 1;
+    }
+    for(int r=0; r<ranks.size(); ++r) paths.push_back(std::make_pair(l, ranks[r]));
+
+    // every loss of the sweep has to be supported by the algorithm
+    configuration conf_loss = conf;
+    conf_loss.loss = losses[l];
+    Solver* check = make_solver(conf_loss, INIT_RANDOM, 1, false);
+    if (check == NULL) return -1;
+    delete check;
+  }
+
+  int n_parallel       = std::max(1, std::min(conf.sweep_parallel, (int)paths.size()));
+  int n_threads_path   = std::max(1, conf.n_threads / n_parallel);
+
+  FILE *out = NULL;
+  if (conf.sweep_output.length() > 0) {
+    out = fopen(conf.sweep_output.c_str(), "w");
+    if (out == NULL) {
+      printf("Error in opening the sweep output file!\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  printf("Sweep over %d configurations, %d at a time with %d threads each..\n", (int)(paths.size() * lambdas.size()), n_parallel, n_threads_path);
+  printf("loss, rank, lambda, iterations, training time (sec), objective, %s%s\n", prob.validation.empty() ? "" : "validation error, ", metric_columns.c_str());
+
+  omp_set_max_active_levels(2);
+
+  #pragma omp parallel for num_threads(n_parallel) schedule(dynamic,1)
+  for(int p=0; p<paths.size(); ++p) {
+    omp_set_num_threads(n_threads_path);
+
+    const std::string& loss = losses[paths[p].first];
+    loss_option_t option;
+    parse_loss(loss, option);
+    int rank = paths[p].second;
+
+    Model model(prob.n_users, prob.n_items, rank);
+    Solver* mySolver = make_solver(conf, init_option, n_threads_path, false);
+    mySolver->set_verbose(false);
+    SolverAltSVM* altsvm = dynamic_cast<SolverAltSVM*>(mySolver);
+    if (altsvm != NULL) altsvm->set_warm_start(true);
+
+    for(int l=0; l<lambdas.size(); ++l) {
+      if (l > 0) mySolver->set_init(INIT_PREDETERMINED);
+      mySolver->set_objective(option, lambdas[l]);
+      mySolver->solve(prob, model, NULL);
+
+      const trace_point& last = mySolver->trace.back();
+      double validation = prob.validation.empty() ? 0. : prob.validation_error(model);
+
+      #pragma omp critical (sweep)
+      {
+        printf("%s, %d, %g, %d, %f, %f, ", loss.c_str(), rank, lambdas[l], last.iter, last.time, last.f);
+        if (!prob.validation.empty()) printf("%f, ", validation);
+
+        std::vector<std::pair<std::string, double> > fields;
+        fields.push_back(std::make_pair("rank", (double)rank));
+        fields.push_back(std::make_pair("lambda", lambdas[l]));
+        fields.push_back(std::make_pair("iterations", (double)last.iter));
+        fields.push_back(std::make_pair("time", last.time));
+        fields.push_back(std::make_pair("objective", last.f));
+        if (!prob.validation.empty()) fields.push_back(std::make_pair("validation_error", validation));
+        if (eval != NULL) {
+          eval->evaluate_full(model);
+          fields.insert(fields.end(), eval->results.begin(), eval->results.end());
+        }
+        printf("\n");
+        fflush(stdout);
+
+        if (out != NULL) {
+          if (ftell(out) == 0) {
+            fprintf(out, "loss");
+            for(int i=0; i<fields.size(); ++i) fprintf(out, "\t%s", fields[i].first.c_str());
+            fprintf(out, "\n");
+          }
+          fprintf(out, "%s", loss.c_str());
+          for(int i=0; i<fields.size(); ++i) fprintf(out, "\t%.10g", fields[i].second);
+          fprintf(out, "\n");
+          fflush(out);
+        }
+
+        metrics.emit("sweep", fields);
+      }
+    }
+
+    delete mySolver;
+  }
+
+  if (out != NULL) fclose(out);
+  return 0;
+}
+
+// quantize the trained model with every scheme of conf.quantize, export it and print the
+// recall@K of the coarse-then-rerank top-K against the exact top-K
+int run_quantize(const configuration& conf, const Model& model) {
+  std::vector<quant_option_t> options(conf.quantize.size());
+  for(int q=0; q<conf.quantize.size(); ++q) {
+    if (!parse_quant(conf.quantize[q], options[q])) {
+      std::cerr << "ERROR : provide correct quantize option !\n";
+      return -1;
+    }
+  }
+
+  std::vector<int> users(model.n_users);
+  for(int uid=0; uid<model.n_users; ++uid) users[uid] = uid;
+  if ((conf.quantize_users > 0) && (conf.quantize_users < model.n_users)) {
+    std::mt19937 gen(conf.eval_seed);
+    std::shuffle(users.begin(), users.end(), gen);
+    users.resize(conf.quantize_users);
+  }
+
+  printf("scheme, size (MB), recall@%d, exact top-K (sec), quantized top-K (sec)\n", conf.quantize_topk);
+  printf("double, %.3f, 1.000000\n", (double)sizeof(double) * ((long long)model.n_users + model.n_items) * model.rank / 1048576.);
+
+  for(int q=0; q<options.size(); ++q) {
+    QuantizedFactors QU, QV;
+    {
+      ScopedTimer timer("quantize");
+      QU.quantize(model.U, model.n_users, model.rank, options[q]);
+      QV.quantize(model.V, model.n_items, model.rank, options[q]);
+    }
+
+    if (conf.quantize_output.length() > 0) {
+      std::string file = conf.quantize_output + "." + quant_name(options[q]);
+      if (!write_quantized(file, QU, QV)) {
+        std::cerr << "ERROR : cannot write " << file << " !\n";
+        return -1;
+      }
+    }
+
+    double time_exact, time_quant;
+    double recall = quantized_recall(model, QU, QV, conf.quantize_topk, conf.quantize_shortlist, users, time_exact, time_quant);
+    printf("%s, %.3f, %f, %f, %f\n", quant_name(options[q]), (double)(QU.bytes() + QV.bytes()) / 1048576., recall, time_exact, time_quant);
+
+    std::vector<std::pair<std::string, double> > fields;
+    fields.push_back(std::make_pair("bytes", (double)(QU.bytes() + QV.bytes())));
+    fields.push_back(std::make_pair("recall@" + std::to_string(conf.quantize_topk), recall));
+    fields.push_back(std::make_pair("exact_sec", time_exact));
+    fields.push_back(std::make_pair("quantized_sec", time_quant));
+    metrics.emit(std::string("quantize_") + quant_name(options[q]), fields);
+  }
+
+  return 0;
+}
+
+// load model_file (sizes from model_users or model_items and the file size) and write the top-K
+// unseen items of every requested user, scoring blocks of users in parallel
+int run_recommend(const configuration& conf) {
+  recommend_format_t format;
+  if (conf.recommend_format == "tsv")
+    format = RECOMMEND_TSV;
+  else if (conf.recommend_format == "binary")
+    format = RECOMMEND_BINARY;
+  else {
+    std::cerr << "ERROR : provide correct recommend_format option !\n";
+    return -1;
+  }
+
+  if ((conf.model_file.length() == 0) || (conf.recommend_output.length() == 0)) {
+    std::cerr << "ERROR : recommend mode needs model_file and recommend_output !\n";
+    return -1;
+  }
+  if (conf.recommend_k <= 0) {
+    std::cerr << "ERROR : recommend_k must be positive !\n";
+    return -1;
+  }
+
+  std::ifstream mf(conf.model_file, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!mf.is_open()) {
+    std::cerr << "ERROR : cannot open " << conf.model_file << " !\n";
+    return -1;
+  }
+  long long n_rows = (long long)mf.tellg() / (sizeof(double) * conf.rank);
+  mf.close();
+
+  int n_users = conf.model_users, n_items = conf.model_items;
+  if (n_users <= 0) n_users = n_rows - n_items;
+  if (n_items <= 0) n_items = n_rows - n_users;
+  if ((n_users <= 0) || (n_items <= 0) || ((long long)n_users + n_items != n_rows)) {
+    std::cerr << "ERROR : model_file does not hold model_users + model_items rows of the given rank !\n";
+    return -1;
+  }
+
+  Model model(n_users, n_items, conf.rank);
+  {
+    std::cout << "Loading model file : " << conf.model_file << std::endl;
+    ScopedTimer timer("load_model");
+    model.readFile(conf.model_file);
+  }
+
+  SeenItems seen;
+  if (conf.recommend_seen.length() > 0) {
+    std::cout << "Loading seen items file : " << conf.recommend_seen << std::endl;
+    ScopedTimer timer("load_seen");
+    if (!seen.read(conf.recommend_seen, n_users)) {
+      std::cerr << "ERROR : cannot open " << conf.recommend_seen << " !\n";
+      return -1;
+    }
+  }
+
+  std::vector<int> users;
+  if (conf.recommend_users.length() > 0) {
+    std::ifstream uf(conf.recommend_users);
+    if (!uf.is_open()) {
+      std::cerr << "ERROR : cannot open " << conf.recommend_users << " !\n";
+      return -1;
+    }
+    int uid;
+    while (uf >> uid) if ((uid >= 1) && (uid <= n_users)) users.push_back(uid-1);
+  }
+  else {
+    users.resize(n_users);
+    for(int uid=0; uid<n_users; ++uid) users[uid] = uid;
+  }
+
+  RecommendationWriter writer;
+  if (!writer.open(conf.recommend_output, format, conf.recommend_k)) {
+    std::cerr << "ERROR : cannot write " << conf.recommend_output << " !\n";
+    return -1;
+  }
+
+  printf("Top-%d items of %d users (%d users, %d items, rank %d) with %d threads..\n",
+         conf.recommend_k, (int)users.size(), n_users, n_items, conf.rank, conf.n_threads);
+
+  int block = std::max(conf.recommend_block, 1), tile = std::max(conf.recommend_tile, 1);
+  int n_blocks = ((int)users.size() + block - 1) / block;
+  double time = omp_get_wtime();
+  {
+    ScopedTimer timer("recommend");
+
+    #pragma omp parallel
+    {
+      std::vector<double> scores;
+      std::vector<std::vector<std::pair<double, int> > > heaps;
+      std::string buf;
+
+      #pragma omp for schedule(dynamic)
+      for(int bl=0; bl<n_blocks; ++bl) {
+        int b0 = bl * block, n_block = std::min(block, (int)users.size() - b0);
+        topk_block(model, &users[b0], n_block, conf.recommend_k, seen.ptr.empty() ? NULL : seen.ptr.data(), seen.items.data(),
+                   tile, scores, heaps);
+        for(int b=0; b<n_block; ++b) writer.add(buf, users[b0+b], heaps[b]);
+      }
+      writer.flush(buf);
+    }
+  }
+  writer.close();
+  time = omp_get_wtime() - time;
+
+  printf("%d users in %f sec (%.0f users/sec) : %s\n", (int)users.size(), time, (double)users.size() / time, conf.recommend_output.c_str());
+
+  std::vector<std::pair<std::string, double> > fields;
+  fields.push_back(std::make_pair("users", (double)users.size()));
+  fields.push_back(std::make_pair("items", (double)n_items));
+  fields.push_back(std::make_pair("k", (double)conf.recommend_k));
+  metrics.emit("recommend", fields);
+
+  return 0;
+}
+
+// complete "user item1 item2" lines of file from byte offset on (1-based ids, stored 0-based);
+// offset moves past them. Lines without three ids >= 1 are skipped with a warning.
+void read_new_comparisons(const std::string& file, long long& offset, std::vector<comparison>& comps) {
+  comps.clear();
+  std::ifstream f(file);
+  if (!f.is_open()) return;
+  f.seekg(offset);
+
+  std::string line;
+  while (std::getline(f, line)) {
+    if (f.eof()) break;                   // a line still being written
+    long long line_offset = offset;
+    offset += line.size() + 1;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    int uid, i1id, i2id;
+    if ((sscanf(line.c_str(), "%d %d %d", &uid, &i1id, &i2id) == 3) && (uid >= 1) && (i1id >= 1) && (i2id >= 1))
+      comps.push_back(comparison(uid-1, i1id-1, i2id-1, 1));
+    else
+      printf("Warning : skipping the malformed line at byte %lld of %s\n", line_offset, file.c_str());
+  }
+}
+
+// resume altsvm from model_file and state_file on the comparisons of incremental_file; with
+// follow, keep polling the file for appended lines and train on each batch
+int run_incremental(const configuration& conf, Problem& prob, Evaluator* eval, const std::string& metric_columns) {
+  if ((conf.model_file.length() == 0) || (conf.state_file.length() == 0) || (conf.incremental_file.length() == 0)) {
+    std::cerr << "ERROR : incremental mode needs model_file, state_file and incremental_file !\n";
+    return -1;
+  }
+
+  // incremental_file is read from where the state left it
+  long long offset = 0;
+  SolverAltSVMIncremental solver(conf.n_threads, conf.incremental_sweeps, conf.refresh_iters);
+  solver.set_stopping(conf.tol, 0);
+  solver.set_seed(conf.init_seed);
+  {
+    ScopedTimer timer("load_state");
+    if (!solver.read_state(conf.state_file, prob, offset)) return -1;
+  }
+
+  Model model(prob.n_users, prob.n_items, conf.rank);
+  std::cout << "Loading model file : " << conf.model_file << std::endl;
+  model.readFile(conf.model_file);
+  std::string model_output = (conf.model_output.length() > 0) ? conf.model_output : conf.model_file;
+
+  for(int round = 1; (conf.follow_rounds <= 0) || (round <= conf.follow_rounds); ) {
+    std::vector<comparison> comps;
+    read_new_comparisons(conf.incremental_file, offset, comps);
+
+    if (comps.empty()) {
+      if (!conf.follow) break;
+      std::this_thread::sleep_for(std::chrono::seconds(conf.follow_poll_sec));
+      continue;
+    }
+
+    int n_affected = solver.append(prob, model, comps);
+    printf("round %d : %d new comparisons of %d users (%d users, %d items, %d comparisons)\n",
+           round, (int)comps.size(), n_affected, prob.n_users, prob.n_items, prob.n_train_comps);
+    printf("iteration, training time (sec), %s\n", metric_columns.c_str());
+
+    double time = omp_get_wtime();
+    solver.solve(prob, model, eval);
+    time = omp_get_wtime() - time;
+
+    {
+      ScopedTimer timer("write_model");
+      model.writeFile(model_output);
+      if (!solver.write_state(conf.state_file, prob, offset)) return -1;
+    }
+
+    std::vector<std::pair<std::string, double> > fields;
+    fields.push_back(std::make_pair("round", (double)round));
+    fields.push_back(std::make_pair("new_comparisons", (double)comps.size()));
+    fields.push_back(std::make_pair("affected_users", (double)n_affected));
+    fields.push_back(std::make_pair("seconds", time));
+    metrics.emit("incremental", fields);
+
+    if (!conf.follow) break;
+    ++round;
+  }
+
+  return 0;
+}
+
 int main (int argc, char* argv[]) {
   struct configuration conf;
   std::string config_file = "config/default.cfg";
@@ -110,15 +881,7 @@ int main (int argc, char* argv[]) {
   // Problem definition 
   Problem prob;
  
-  if (conf.loss == "l1hinge")
-    prob.loss_option = L1_HINGE;
-  else if (conf.loss == "l2hinge")
-    prob.loss_option = L2_HINGE;
-  else if (conf.loss == "logistic")
-    prob.loss_option = LOGISTIC;
-  else if (conf.loss == "squared")
-    prob.loss_option = SQUARED;
-  else {
+  if (!parse_loss(conf.loss, prob.loss_option)) {
     std::cerr << "ERROR : provide correct loss function !\n";
     return 1;
   }
@@ -129,76 +892,292 @@ int main (int argc, char* argv[]) {
   }
 
   prob.lambda = conf.lambda;
+  prob.max_comps_per_user = conf.max_comps_per_user;
+  prob.max_comps_per_pair = conf.max_comps_per_pair;
+  prob.sampling_seed      = conf.ingest.seed;
 
-  std::cout << "Loading training set file : " << conf.train_comps_file << std::endl;
-  prob.read_data(conf.train_comps_file);
+  if (conf.metrics_output.length() > 0) metrics.open(conf.metrics_output);
 
-  // Model definition
-  Model model(prob.get_nusers(), prob.get_nitems(), conf.rank);
+  omp_set_dynamic(0);
+  omp_set_num_threads(conf.n_threads);
 
-  if (conf.model_file.length() > 0) {
-    std::cout << "Loading initial model file : " << conf.model_file << std::endl;
-    model.readFile(conf.model_file);
+  if (conf.mode == "recommend") {
+    int ret = run_recommend(conf);
+    metrics.emit("done", std::vector<std::pair<std::string, double> >());
+    metrics.close();
+    return ret;
+  }
+  else if (conf.mode != "train" && conf.mode != "incremental") {
+    std::cerr << "ERROR : provide correct mode !\n";
+    return -1;
   }
 
   // Evaluator definition
-  Evaluator* eval;
+  Evaluator* eval = NULL;
+  vector<int> k_list;
+
+  if (conf.type_str == "numeric") {
+    k_list = conf.ndcg_k;
+    std::sort(k_list.begin(), k_list.end());
+  }
+  else if (conf.type_str == "binary") {
+    k_list.push_back(1);
+    k_list.push_back(5);
+    k_list.push_back(10);
+    k_list.push_back(100);
+  } 
+
+  ShardedComparisons shards;
+  if (conf.out_of_core) {
+    if (conf.algo != "altsvm") {
+      std::cerr << "ERROR : out_of_core is only supported by altsvm !\n";
+      return -1;
+    }
+    if ((conf.ratings_file.length() > 0) || (conf.validation_frac > 0.) ||
+        !conf.sweep_loss.empty() || !conf.sweep_rank.empty() || !conf.sweep_lambda.empty()) {
+      std::cerr << "ERROR : out_of_core reads train_comps_file and does not support validation_frac or sweeps !\n";
+      return -1;
+    }
+    if (conf.init == "svd") {
+      std::cerr << "ERROR : out_of_core does not support init = svd !\n";
+      return -1;
+    }
+  }
+
+  // everything that holds a full n_items x rank array next to the paged V is rejected
+  if (conf.paged_model.length() > 0) {
+    if (((conf.algo != "altsvm") || (conf.v_solver != "dcd")) && ((conf.algo != "sgd") || (conf.stepsize != "schedule"))) {
+      std::cerr << "ERROR : paged_model needs altsvm with v_solver = dcd or sgd with stepsize = schedule !\n";
+      return -1;
+    }
+    if ((conf.init == "svd") || (conf.validation_frac > 0.) || (conf.mode == "incremental") ||
+        !conf.sweep_loss.empty() || !conf.sweep_rank.empty() || !conf.sweep_lambda.empty()) {
+      std::cerr << "ERROR : paged_model does not support init = svd, validation_frac, incremental mode or sweeps !\n";
+      return -1;
+    }
+  }
+
+  ImplicitFeedback implicit;
+  if (conf.implicit) {
+    if ((conf.type_str != "binary") || (conf.train_file.length() == 0)) {
+      std::cerr << "ERROR : implicit needs type = binary and train_rating_file !\n";
+      return -1;
+    }
+    if (conf.out_of_core || (conf.ratings_file.length() > 0) || (conf.mode == "incremental")) {
+      std::cerr << "ERROR : implicit does not support out_of_core, ratings_file or incremental mode !\n";
+      return -1;
+    }
+    if (!conf.sweep_loss.empty() || !conf.sweep_rank.empty() || !conf.sweep_lambda.empty()) {
+      std::cerr << "ERROR : implicit does not support sweeps !\n";
+      return -1;
+    }
+    if ((conf.negative_sampling != "uniform") && (conf.negative_sampling != "popularity")) {
+      std::cerr << "ERROR : provide correct negative_sampling option !\n";
+      return -1;
+    }
+  }
+
+  if (conf.implicit) {
+    std::cout << "Loading positives file : " << conf.train_file << std::endl;
+    ScopedTimer timer("load_train");
+    if (!implicit.read(conf.train_file)) {
+      printf("Error in opening the positives file!\n");
+      return -1;
+    }
+    implicit.prepare((conf.negative_sampling == "popularity") ? NEG_POPULARITY : NEG_UNIFORM);
+    implicit.fill(prob, conf.negatives_per_positive, conf.ingest.seed);
+  }
+  else if (conf.ratings_file.length() > 0) {
+    // split (user, item, rating) triples and generate comparisons in memory
+    std::cout << "Ingesting ratings file : " << conf.ratings_file << std::endl;
+    ScopedTimer timer("ingest");
+
+    RatingIngest ingest;
+    ingest.read_triples(conf.ratings_file);
 
-  if (conf.test_file.length() > 0) {
-    vector<int> k_list;
-  
+    if (conf.type_str == "numeric") {
+      RatingMatrix train_ratings, test_ratings;
+      ingest.split_numeric(conf.ingest, prob, train_ratings, test_ratings);
+      if (conf.ingest_output.length() > 0) {
+        prob.write_data(conf.ingest_output + "_train.dat");
+        train_ratings.write_lsvm(conf.ingest_output + "_train_ratings.lsvm");
+        test_ratings.write_lsvm(conf.ingest_output + "_test_ratings.lsvm");
+      }
+
+      EvaluatorRating *eval_rating = new EvaluatorRating;
+      eval_rating->set_data(std::move(test_ratings), k_list);
+      eval = eval_rating;
+    }
+    else if (conf.type_str == "binary") {
+      std::vector<std::unordered_set<int> > train_pairs, test_pairs;
+      ingest.split_binary(conf.ingest, prob, train_pairs, test_pairs);
+      if (conf.ingest_output.length() > 0) {
+        prob.write_data(conf.ingest_output + "_train.dat");
+        write_pairs(train_pairs, conf.ingest_output + "_train_bin.dat");
+        write_pairs(test_pairs, conf.ingest_output + "_test.dat");
+      }
+
+      EvaluatorBinary *eval_binary = new EvaluatorBinary;
+      eval_binary->set_data(std::move(train_pairs), std::move(test_pairs), k_list);
+      eval = eval_binary;
+    }
+  }
+  else if (conf.out_of_core) {
+    if (conf.shard_prefix.length() == 0) conf.shard_prefix = conf.train_comps_file;
+    ScopedTimer timer("load_train");
+    if (!shards.load_index(conf.shard_prefix, conf.train_comps_file)) {
+      std::cout << "Sharding training set file : " << conf.train_comps_file << std::endl;
+      shards.build(conf.train_comps_file, conf.shard_prefix, conf.shard_comps);
+    }
+    prob.n_users       = shards.n_users;
+    prob.n_items       = shards.n_items;
+    prob.n_train_comps = shards.n_comps;
+  }
+  else if (conf.mode == "incremental") {
+    // the training history comes with the dual state
+  }
+  else {
+    std::cout << "Loading training set file : " << conf.train_comps_file << std::endl;
+    ScopedTimer timer("load_train");
+    prob.read_data(conf.train_comps_file);
+  }
+
+  if (conf.validation_frac > 0.) prob.split_validation(conf.validation_frac, conf.ingest.seed);
+
+  if ((eval == NULL) && (conf.test_file.length() > 0)) {
     if (conf.type_str == "numeric") {
       eval = new EvaluatorRating;
-      // current only ndcg@10 can be computed 
-      k_list.push_back(10);
     }
     else if (conf.type_str == "binary") {
       eval = new EvaluatorBinary;
-      k_list.push_back(1);
-      k_list.push_back(5);
-      k_list.push_back(10);
-      k_list.push_back(100);
     } 
 
     std::cout << "Reading test set file : " << conf.test_file << std::endl;
+    ScopedTimer timer("load_test");
     eval->load_files(conf.train_file, conf.test_file, k_list);
   }
 
-  // Solver definition
-  omp_set_dynamic(0);
-  omp_set_num_threads(conf.n_threads);
+  if ((eval != NULL) && (conf.eval_sample_users > 0)) {
+    eval->set_sampling(conf.eval_sample_users, conf.eval_full_every, conf.eval_seed);
+    if (eval->is_sampling()) printf("Monitoring %d sampled test users (95%% confidence intervals)\n", conf.eval_sample_users);
+  }
 
-  Solver* mySolver;
-  init_option_t init_option = (conf.model_file.length() > 0) ? INIT_PREDETERMINED : INIT_RANDOM; 
+  std::string metric_columns;
+  if (conf.type_str == "numeric") {
+    metric_columns = "pairwise error";
+    for(int c=0; c<k_list.size(); ++c) metric_columns += ", ndcg@" + std::to_string(k_list[c]);
+  }
+  else if (conf.type_str == "binary") {
+    metric_columns = "precision@K";
+  }
 
-  if (conf.algo == "altsvm") {
-    printf("AltSVM with %d threads..\n", conf.n_threads);
-    mySolver = new SolverAltSVM(init_option, conf.n_threads, conf.max_iter);
+  if (conf.mode == "incremental") {
+    int ret = run_incremental(conf, prob, eval, metric_columns);
+    metrics.emit("done", std::vector<std::pair<std::string, double> >());
+    metrics.close();
+    return ret;
   }
-  else if (conf.algo == "sgd") {
-    printf("SGD with %d threads.. \n", conf.n_threads);
-    mySolver = new SolverSGD(conf.alpha, conf.beta, init_option, conf.n_threads, conf.max_iter);
+
+  // Model definition
+  Model model(conf.rank);
+  if (conf.paged_model.length() > 0) {
+    if (!model.allocate_paged(prob.get_nusers(), prob.get_nitems(), conf.paged_model, conf.paged_users,
+                              (size_t)conf.paged_working_set_mb << 20, (size_t)conf.paged_chunk_kb << 10)) {
+      std::cerr << "ERROR : cannot map the paged model files !\n";
+      return -1;
+    }
+    printf("Paged model : %s.V%s, working set %d MB per factor\n", conf.paged_model.c_str(),
+           conf.paged_users ? " and .U" : "", conf.paged_working_set_mb);
   }
-  else if (conf.algo == "global") {
-    printf("Global ranking with all-aggregated comparisons.. \n");
-    mySolver = new SolverGlobal(init_option, conf.n_threads, conf.max_iter);
+  else
+    model.allocate(prob.get_nusers(), prob.get_nitems());
+
+  if (conf.model_file.length() > 0) {
+    std::cout << "Loading initial model file : " << conf.model_file << std::endl;
+    model.readFile(conf.model_file);
   }
-  else {
-    std::cerr << "ERROR : provide correct algorithm !\n";
+
+  {
+    std::vector<std::pair<std::string, double> > fields;
+    fields.push_back(std::make_pair("users", (double)prob.n_users));
+    fields.push_back(std::make_pair("items", (double)prob.n_items));
+    fields.push_back(std::make_pair("comparisons", (double)prob.n_train_comps));
+    fields.push_back(std::make_pair("rank", (double)conf.rank));
+    fields.push_back(std::make_pair("threads", (double)conf.n_threads));
+    metrics.emit("load", fields);
+  }
+
+  init_option_t init_option = INIT_RANDOM;
+  if (conf.init == "svd")
+    init_option = INIT_SVD;
+  else if (conf.init != "random") {
+    std::cerr << "ERROR : provide correct init option !\n";
     return -1;
   }
 
-  if (conf.type_str == "numeric") {
-    printf("iteration, training time (sec), pairwise error, ndcg@10\n");
+  if (!conf.sweep_loss.empty() || !conf.sweep_rank.empty() || !conf.sweep_lambda.empty()) {
+    int ret = run_sweep(conf, init_option, prob, eval, metric_columns);
+    metrics.emit("done", std::vector<std::pair<std::string, double> >());
+    metrics.close();
+    return ret;
   }
-  else if (conf.type_str == "binary") {
-    printf("iteration, training time (sec), precision@K\n"); 
+
+  // Solver definition
+  if (conf.model_file.length() > 0) init_option = INIT_PREDETERMINED; 
+  Solver* mySolver;
+  if (conf.out_of_core) {
+    printf("Out-of-core AltSVM with %d threads, %d shard buffers..\n", conf.n_threads, conf.shard_buffers);
+    mySolver = new SolverAltSVMOOC(shards, conf.shard_buffers, init_option, conf.n_threads, conf.max_iter);
+    mySolver->set_stopping(conf.tol, conf.patience);
+    mySolver->set_seed(conf.init_seed);
   }
+  else
+    mySolver = make_solver(conf, init_option, conf.n_threads, true);
+  if (mySolver == NULL) return -1;
+  mySolver->set_prefetch_batch(conf.paged_batch);
+
+  printf("iteration, training time (sec), %s%s\n", prob.validation.empty() ? "" : "validation error, ", metric_columns.c_str());
+
+  // keep the duals of altsvm to write the state for incremental training
+  SolverAltSVM* altsvm = (conf.state_file.length() > 0) && !conf.out_of_core ? dynamic_cast<SolverAltSVM*>(mySolver) : NULL;
+  if (altsvm != NULL) altsvm->set_warm_start(true);
+
+  mySolver->solve(prob, model, conf.evaluate_every_iter ? eval : NULL);
 
-  mySolver->solve(prob, model, eval);
+  if (altsvm != NULL) {
+    ScopedTimer timer("write_state");
+    if (!altsvm->write_state(conf.state_file, prob)) return -1;
+  }
   delete mySolver;
 
-  if (conf.model_output.length() > 0) model.writeFile(conf.model_output);
+  if (model.is_paged()) {
+    long long n_prefetched, n_released;
+    model.paging_stats(n_prefetched, n_released);
+    printf("paging : %lld chunks prefetched, %lld released\n", n_prefetched, n_released);
+    metrics.add_count("paged_prefetch", n_prefetched);
+    metrics.add_count("paged_release", n_released);
+  }
+
+  // the per-iteration results were estimates or skipped
+  if ((eval != NULL) && (eval->is_sampling() || !conf.evaluate_every_iter)) {
+    printf("final, ");
+    {
+      ScopedTimer timer("evaluate");
+      eval->evaluate_full(model);
+    }
+    printf("\n");
+    metrics.emit("final", eval->results);
+  }
+
+  if (conf.model_output.length() > 0) {
+    ScopedTimer timer("write_model");
+    model.writeFile(conf.model_output);
+  }
+
+  if (!conf.quantize.empty() && (run_quantize(conf, model) != 0)) return -1;
+
+  metrics.emit("done", std::vector<std::pair<std::string, double> >());
+  metrics.close();
 
   return 0;
 }
@@ -0,0 +1,63 @@
+#ifndef __COLLRANK_H__
+#define __COLLRANK_H__
+
+/* C API of libcollrank (make lib). Factor buffers are row-major and owned by the caller:
+ * U is n_users x rank, V is n_items x rank, and they are read and written in place.
+ * Ids are 0-based. Functions returning int return 0 on success and -1 on error,
+ * with the message in collrank_last_error(). */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* user prefers item1 over item2; comp is ignored (same layout as the internal comparison) */
+typedef struct {
+  int user, item1, item2, comp;
+} collrank_comparison;
+
+typedef struct {
+  const char *algorithm;      /* "altsvm" (default), "sgd", "global" or "alsrank" (squared loss) */
+  const char *loss;           /* "l2hinge" (default), "l1hinge", "logistic" or "squared" */
+  const char *stepsize;       /* sgd : "schedule" (default), "adagrad", "rmsprop" or "adam" */
+  double      lambda;         /* 1000 */
+  double      stepsize_alpha; /* 0.1 */
+  double      stepsize_beta;  /* 1e-5 */
+  double      tol;            /* 1e-5 */
+  int         max_iter;       /* 10 */
+  int         n_threads;      /* 1 */
+  int         init;           /* 0 : random (default), 1 : randomized SVD, 2 : start from U, V as given */
+  unsigned    seed;           /* 1 */
+} collrank_options;
+
+/* called after every (half-)iteration; return 0 to stop training */
+typedef int (*collrank_progress_fn)(int iter, double time, double objective, void *user_data);
+
+void collrank_default_options(collrank_options *opt);
+const char* collrank_last_error(void);
+
+/* train U and V on n comparisons */
+int collrank_train(const collrank_comparison *comps, long long n, int n_users, int n_items, int rank,
+                   double *U, double *V, const collrank_options *opt,
+                   collrank_progress_fn progress, void *user_data);
+
+/* the vector u (rank) of a new user from its n comparisons (user field ignored), V fixed;
+ * hinge losses only, sweeps passes of dual coordinate descent */
+int collrank_fold_in(const collrank_comparison *comps, long long n, const double *V, int n_items, int rank,
+                     const collrank_options *opt, int sweeps, double *u);
+
+/* out[i] = <U[users[i]], V[items[i]]> */
+void collrank_score(const double *U, const double *V, int rank,
+                    const int *users, const int *items, long long n, double *out);
+
+/* the k best items of each of the n users, best first, into out_items / out_scores (n x k);
+ * seen_ptr / seen_items (CSR over all n_users, sorted items; may be NULL) are excluded.
+ * Rows with fewer than k candidates are padded with item -1. */
+int collrank_topk(const double *U, const double *V, int n_users, int n_items, int rank,
+                  const int *users, int n, int k, const long long *seen_ptr, const int *seen_items,
+                  int n_threads, int *out_items, double *out_scores);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
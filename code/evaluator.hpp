@@ -3,33 +3,141 @@
 
 #include <utility>
 #include <vector>
+#include <string>
 #include <algorithm>
 #include <queue>
 #include <iostream>
 #include <fstream>
 #include <unordered_set>
+#include <random>
+#include <math.h>
 
 #include "model.hpp"
 #include "ratings.hpp"
 #include "loss.hpp"
 
+struct pkcomp {
+	bool operator() (std::pair<int, double> i, std::pair<int, double> j) {
+		return i.second > j.second;
+	}
+};
+
+typedef std::priority_queue<std::pair<int, double>, std::vector<std::pair<int, double> >, pkcomp> topk_queue;
+
+// top-k items of a user by predicted score, skipping the items in exclude
+// (pq pops them in increasing order of score)
+void score_topk(const Model& model, int uid, int k, const std::unordered_set<int>& exclude, topk_queue& pq) {
+  double *user_vec = &model.U[(long long)uid * model.rank];
+  for (int j = 0; j < model.n_items; ++j) {
+    if (!exclude.empty() && exclude.find(j) != exclude.end()) {
+      continue;
+    }
+    double score = 0;
+    double *item_vec = &model.V[(long long)j * model.rank];
+    for (int l = 0; l < model.rank; ++l) {
+      score += user_vec[l] * item_vec[l];
+    }
+
+    if (pq.size() < k) {
+      pq.push(std::pair<int, double>(j, score));
+    } else if (pq.top().second < score) {
+      pq.push(std::pair<int, double>(j, score));
+      pq.pop();	
+    }
+  }
+}
+
 class Evaluator {
   public: 
-    virtual void evaluate(const Model&) {} 
+    void evaluate(const Model&);
+    virtual void evaluate_full(const Model&) {}
+    virtual void evaluate_users(const Model&, const std::vector<int>&) {}
     virtual void evaluateAUC(const Model&) {}
     virtual void load_files(const std::string&, const std::string&, std::vector<int>&) = 0;
+    virtual int get_n_users() const = 0;
+
+    void set_sampling(int, int, unsigned);
+    bool is_sampling() const { return !sample_users.empty(); }
  
     std::vector<int> k;
     int k_max;
+
+    // metric values of the last evaluate() call
+    std::vector<std::pair<std::string, double> > results;
+
+  protected:
+    // monitoring mode : a fixed random subset of the test users, and a full evaluation every full_every calls
+    std::vector<int> sample_users;
+    int full_every = 0, n_calls = 0;
+
+    void add_estimate(const std::string&, const double*, int, int, const char*);
 };
 
+// Evaluate a fixed random sample of n_sample test users (drawn once, so that successive
+// estimates are comparable); every full_every-th call (0 : never) evaluates all users.
+void Evaluator::set_sampling(int n_sample, int every, unsigned seed) {
+  int n_users = get_n_users();
+  sample_users.clear();
+  full_every = every;
+  n_calls = 0;
+  if ((n_sample <= 0) || (n_sample >= n_users)) return;
+
+  // partial Fisher-Yates shuffle
+  std::vector<int> perm(n_users);
+  for(int i=0; i<n_users; ++i) perm[i] = i;
+  std::mt19937 gen(seed);
+  for(int i=0; i<n_sample; ++i) {
+    std::uniform_int_distribution<int> pick(i, n_users-1);
+    std::swap(perm[i], perm[pick(gen)]);
+  }
+  sample_users.assign(perm.begin(), perm.begin()+n_sample);
+  std::sort(sample_users.begin(), sample_users.end());
+}
+
+void Evaluator::evaluate(const Model& model) {
+  ++n_calls;
+  if (sample_users.empty() || ((full_every > 0) && (n_calls % full_every == 0))) {
+    evaluate_full(model);
+    return;
+  }
+
+  std::vector<int> users;
+  for(int i=0; i<sample_users.size(); ++i) if (sample_users[i] < model.n_users) users.push_back(sample_users[i]);
+  results.clear();
+  evaluate_users(model, users);
+  results.push_back(std::make_pair("sampled_users", (double)users.size()));
+}
+
+// Mean of the per-user values x[0], x[stride], ... of n sampled users, printed with the
+// half-width of its 95% normal confidence interval (with finite population correction).
+void Evaluator::add_estimate(const std::string& name, const double* x, int n, int stride, const char* format) {
+  double sum = 0., sum_sq = 0.;
+  for(int i=0; i<n; ++i) { sum += x[i*stride]; sum_sq += x[i*stride] * x[i*stride]; }
+  double mean = (n > 0) ? sum / n : 0.;
+  double var  = (n > 1) ? std::max(0., (sum_sq - n * mean * mean) / (n-1)) : 0.;
+
+  int n_users = get_n_users();
+  double fpc  = (n_users > 1) ? sqrt((double)(n_users - n) / (double)(n_users - 1)) : 0.;
+  double half = (n > 0) ? 1.96 * sqrt(var / n) * fpc : 0.;
+
+  printf(format, mean, half);
+  results.push_back(std::make_pair(name, mean));
+  results.push_back(std::make_pair(name + "_ci", half));
+}
+
 class EvaluatorBinary : public Evaluator {
   public:
     std::vector<std::unordered_set<int> > train, test;	
 
     void load_files(const std::string&, const std::string&, std::vector<int>&);
-    void evaluate(const Model&);
+    void set_data(std::vector<std::unordered_set<int> >&&, std::vector<std::unordered_set<int> >&&, std::vector<int>&);
+    void evaluate_full(const Model&);
+    void evaluate_users(const Model&, const std::vector<int>&);
     void evaluateAUC(const Model&);
+    int get_n_users() const { return test.size(); }
+
+  private:
+    void user_hits(const Model&, int, int*) const;
 };
 
 class EvaluatorRating : public Evaluator {
@@ -37,29 +145,63 @@ class EvaluatorRating : public Evaluator {
 
   public:
     void load_files(const std::string&, const std::string&, std::vector<int>&);
-    void evaluate(const Model&);
+    void set_data(RatingMatrix&&, std::vector<int>&);
+    void evaluate_full(const Model&);
+    void evaluate_users(const Model&, const std::vector<int>&);
+    int get_n_users() const { return test.n_users; }
 };
 
 void EvaluatorRating::load_files (const std::string& train_repo, const std::string& test_repo, std::vector<int>& ik) {
-  test.read_lsvm(test_repo);
-  test.compute_dcgmax(10);
+  RatingMatrix test_ratings;
+  test_ratings.read_lsvm(test_repo);
+  set_data(std::move(test_ratings), ik);
+}
+
+// test ratings already in memory (e.g. from RatingIngest)
+void EvaluatorRating::set_data (RatingMatrix&& test_ratings, std::vector<int>& ik) {
+  test = std::move(test_ratings);
+  test.compute_dcgmax(ik);
 
 	k = ik;
   std::sort(k.begin(), k.end());
   k_max = k[k.size()-1];
 }
 
-void EvaluatorRating::evaluate(const Model& model) {
+void EvaluatorRating::evaluate_full(const Model& model) {
   double err = compute_pairwiseError(test, model);
-  double ndcg = compute_ndcg(test, model);
-  printf("%f, %f", err, ndcg);
+  std::vector<double> ndcg;
+  compute_ndcg(test, model, ndcg);
+  printf("%f", err);
+  for(int c=0; c<ndcg.size(); ++c) printf(", %f", ndcg[c]);
+
+  results.clear();
+  results.push_back(std::make_pair("pairwise_error", err));
+  for(int c=0; c<ndcg.size(); ++c) results.push_back(std::make_pair("ndcg@" + std::to_string(test.ndcg_cutoffs[c]), ndcg[c]));
 }
 
-struct pkcomp {
-	bool operator() (std::pair<int, double> i, std::pair<int, double> j) {
-		return i.second > j.second;
-	}
-};
+// per-user pairwise error and NDCG of the given users, reported as estimates of the means over all users
+void EvaluatorRating::evaluate_users(const Model& model, const std::vector<int>& users) {
+  int n = users.size(), n_cutoffs = test.ndcg_cutoffs.size();
+  std::vector<double> x(n * (1+n_cutoffs));
+
+  #pragma omp parallel
+  {
+    std::vector<std::pair<double,double> > buf;
+    std::vector<double> sc, tmp;
+    std::vector<int> order;
+
+    #pragma omp for schedule(dynamic,16)
+    for(int i=0; i<n; ++i) {
+      double *x_user = &x[i * (1+n_cutoffs)];
+      x_user[0] = compute_user_pairwiseError(test, model, users[i], buf, sc, tmp);
+      compute_user_scores(test, model, users[i], sc);
+      test.compute_user_ndcg(users[i], sc, order, x_user+1);
+    }
+  }
+
+  add_estimate("pairwise_error", &x[0], n, 1+n_cutoffs, "%f +- %f");
+  for(int c=0; c<n_cutoffs; ++c) add_estimate("ndcg@" + std::to_string(test.ndcg_cutoffs[c]), &x[c+1], n, 1+n_cutoffs, ", %f +- %f");
+}
 
 struct vcomp {
 	bool operator() (std::pair<int, double> i, std::pair<int, double> j) {
@@ -100,45 +242,77 @@ void EvaluatorBinary::load_files (const std::string& train_repo, const std::stri
   k_max = k[k.size()-1];
 } 
 
-void EvaluatorBinary::evaluate (const Model& model) {
-  vector<int> precision(k.size(), 0);
+// training and test pairs already in memory (e.g. from RatingIngest)
+void EvaluatorBinary::set_data (std::vector<std::unordered_set<int> >&& train_pairs, std::vector<std::unordered_set<int> >&& test_pairs, std::vector<int>& ik) {
+  train = std::move(train_pairs);
+  test  = std::move(test_pairs);
+
+	k = ik;
+  std::sort(k.begin(), k.end());
+  k_max = k[k.size()-1];
+} 
+
+// hits[l] : number of test items of user i among its top k[l] items
+void EvaluatorBinary::user_hits(const Model& model, int i, int* hits) const {
+  for(int l=0; l<k.size(); ++l) hits[l] = 0;
+
+  topk_queue pq;
+  score_topk(model, i, k_max, train[i], pq);
+
+  while(!pq.empty()) {
+    int item = pq.top().first;
+    if (!test[i].empty() && test[i].find(item) != test[i].end()) {
+      for(int j=k.size()-1; (j>=0) && (k[j]>=pq.size()); --j) ++hits[j];
+    }
+    pq.pop();
+  }
+}
+
+void EvaluatorBinary::evaluate_full (const Model& model) {
+  vector<long long> precision(k.size(), 0);
 
 	#pragma omp parallel
-	for (int i = 0; i < model.n_users; ++i) {
-		std::priority_queue<std::pair<int, double>, std::vector<std::pair<int, double> >, pkcomp> pq;	
-		for (int j = 0; j < model.n_items; ++j) {
-			if (!train[i].empty() && train[i].find(j) != train[i].end()) {
-				continue;
-			}
-			double score = 0;
-			double *user_vec = &model.U[i * model.rank];
-			double *item_vec = &model.V[j * model.rank];
-			for (int l = 0; l < model.rank; ++l) {
-				score += user_vec[l] * item_vec[l];
-			}
+  {
+    vector<int> hits(k.size());
+    vector<long long> precision_sum(k.size(), 0);
 
-			if (pq.size() < k_max) {
-				pq.push(std::pair<int, double>(j, score));
-			} else if (pq.top().second < score) {
-				pq.push(std::pair<int, double>(j, score));
-				pq.pop();	
-			}
-		}
+    #pragma omp for
+    for (int i = 0; i < model.n_users; ++i) {
+      user_hits(model, i, hits.data());
+      for(int l=0; l<k.size(); ++l) precision_sum[l] += hits[l];
+    }
 
-    while(!pq.empty()) {
-      int item = pq.top().first;
-      if (!test[i].empty() && test[i].find(item) != test[i].end()) {
-  			for(int j=k.size()-1; (j>=0) && (k[j]>=pq.size()); --j) {
-          #pragma omp atomic
-          ++precision[j];
-        }
-      }
-			pq.pop();
-		}
-	}
+    #pragma omp critical
+    for(int l=0; l<k.size(); ++l) precision[l] += precision_sum[l];
+  }
+
+  results.clear();
+  for(int l=0; l<k.size(); ++l) {
+    double p = (double)precision[l] / (double)k[l] / model.n_users;
+    printf("K%d: %f ", k[l], p);
+    results.push_back(std::make_pair("precision@" + std::to_string(k[l]), p));
+  }
+}
+
+// per-user precision@K of the given users, reported as estimates of the means over all users
+void EvaluatorBinary::evaluate_users (const Model& model, const std::vector<int>& users) {
+  int n = users.size();
+  std::vector<double> x(n * k.size());
+
+	#pragma omp parallel
+  {
+    vector<int> hits(k.size());
+
+    #pragma omp for
+    for (int i = 0; i < n; ++i) {
+      user_hits(model, users[i], hits.data());
+      for(int l=0; l<k.size(); ++l) x[i*k.size()+l] = (double)hits[l] / (double)k[l];
+    }
+  }
 
   for(int l=0; l<k.size(); ++l) {
-    printf("K%d: %f ", k[l], (double)precision[l] / (double)k[l] / model.n_users);
+    std::string format = "K" + std::to_string(k[l]) + ": %f +- %f ";
+    add_estimate("precision@" + std::to_string(k[l]), &x[l], n, k.size(), format.c_str());
   }
 }
 
@@ -153,8 +327,8 @@ void EvaluatorBinary::evaluateAUC(const Model& model) {
 				continue;
 			}
 			double score = 0;
-			double *user_vec = &model.U[i * model.rank];
-			double *item_vec = &model.V[j * model.rank];
+			double *user_vec = &model.U[(long long)i * model.rank];
+			double *item_vec = &model.V[(long long)j * model.rank];
 			for (int l = 0; l < model.rank; ++l) {
 				score += user_vec[l] * item_vec[l];
 			}
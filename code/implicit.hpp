@@ -0,0 +1,161 @@
+#ifndef __IMPLICIT_HPP__
+#define __IMPLICIT_HPP__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <utility>
+
+#include "elements.hpp"
+#include "mmapfile.hpp"
+#include "problem.hpp"
+
+enum negative_option_t {NEG_UNIFORM, NEG_POPULARITY};
+
+// Implicit feedback : the positive (user, item) pairs only, in CSR form (sorted, duplicates
+// removed), and a sampler of negative items for a user, drawn uniformly or in proportion to the
+// number of positives of the item (alias table) and rejected while positive for the user.
+// Users with at least n_items / 32 positives get a bitset of n_items bits for the rejection test
+// (smaller than their item list), the others a binary search in their sorted items.
+class ImplicitFeedback {
+  public:
+    int n_users, n_items;
+    std::vector<long long> ptr;
+    std::vector<int>       items;
+
+    negative_option_t      option;
+    std::vector<long long> bits_offset;     // first word of the bitset of a user, -1 if none
+    std::vector<uint64_t>  bits;
+    std::vector<double>    alias_prob;
+    std::vector<int>       alias;
+
+    ImplicitFeedback() : n_users(0), n_items(0), option(NEG_UNIFORM) {}
+
+    bool read(const std::string&);
+    void prepare(negative_option_t);
+    bool is_positive(int, int) const;
+    int sample(int, std::mt19937&) const;
+    void fill(Problem&, int, unsigned) const;
+};
+
+// "user item" lines, 1-based
+bool ImplicitFeedback::read(const std::string& filename) {
+  MappedFile f;
+  if (!f.open(filename)) return false;
+
+  std::vector<std::pair<int, int> > pairs;
+  n_users = n_items = 0;
+  const char *p = f.data, *end = f.data + f.size;
+  while (p < end) {
+    int uid, iid;
+    const char *q = parse_int(p, end, uid);
+    const char *r = (q != p) ? parse_int(q, end, iid) : q;
+    if ((r != q) && (uid >= 1) && (iid >= 1)) {
+      pairs.push_back(std::make_pair(uid-1, iid-1));
+      n_users = std::max(n_users, uid);
+      n_items = std::max(n_items, iid);
+    }
+    while ((r < end) && (*r != '\n')) ++r;
+    p = r + 1;
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+  ptr.assign(n_users+1, 0);
+  items.resize(pairs.size());
+  for(long long i=0; i<pairs.size(); ++i) {
+    ++ptr[pairs[i].first+1];
+    items[i] = pairs[i].second;
+  }
+  for(int uid=0; uid<n_users; ++uid) ptr[uid+1] += ptr[uid];
+
+  printf("%d users, %d items, %lld positives\n", n_users, n_items, (long long)items.size());
+  return true;
+}
+
+void ImplicitFeedback::prepare(negative_option_t opt) {
+  option = opt;
+
+  int n_words = (n_items + 63) / 64;
+  bits_offset.assign(n_users, -1);
+  long long n_bits_users = 0;
+  for(int uid=0; uid<n_users; ++uid)
+    if ((ptr[uid+1] - ptr[uid]) * 32 >= n_items) bits_offset[uid] = (n_bits_users++) * n_words;
+  bits.assign(n_bits_users * n_words, 0);
+  for(int uid=0; uid<n_users; ++uid) {
+    if (bits_offset[uid] < 0) continue;
+    for(long long e=ptr[uid]; e<ptr[uid+1]; ++e) bits[bits_offset[uid] + items[e] / 64] |= (uint64_t)1 << (items[e] % 64);
+  }
+
+  alias_prob.clear();
+  alias.clear();
+  if (option != NEG_POPULARITY) return;
+
+  // Vose's alias method over the item counts
+  std::vector<double> q(n_items, 0.);
+  for(long long e=0; e<items.size(); ++e) q[items[e]] += 1.;
+  double scale = (items.empty()) ? 1. : (double)n_items / (double)items.size();
+  std::vector<int> small, large;
+  for(int iid=0; iid<n_items; ++iid) {
+    q[iid] *= scale;
+    if (q[iid] < 1.) small.push_back(iid); else large.push_back(iid);
+  }
+  alias_prob.assign(n_items, 1.);
+  alias.resize(n_items);
+  for(int iid=0; iid<n_items; ++iid) alias[iid] = iid;
+  while (!small.empty() && !large.empty()) {
+    int s = small.back(), l = large.back();
+    small.pop_back();
+    alias_prob[s] = q[s];
+    alias[s] = l;
+    q[l] -= 1. - q[s];
+    if (q[l] < 1.) { large.pop_back(); small.push_back(l); }
+  }
+}
+
+inline bool ImplicitFeedback::is_positive(int uid, int iid) const {
+  if (bits_offset[uid] >= 0) return (bits[bits_offset[uid] + iid / 64] >> (iid % 64)) & 1;
+  return std::binary_search(items.begin() + ptr[uid], items.begin() + ptr[uid+1], iid);
+}
+
+// a negative item of user uid, -1 if 64 draws in a row were positives (the caller skips the slot)
+inline int ImplicitFeedback::sample(int uid, std::mt19937& gen) const {
+  std::uniform_int_distribution<int> randitem(0, n_items-1);
+  std::uniform_real_distribution<double> unif(0., 1.);
+  for(int t=0; t<64; ++t) {
+    int iid = randitem(gen);
+    if ((option == NEG_POPULARITY) && (unif(gen) >= alias_prob[iid])) iid = alias[iid];
+    if (!is_positive(uid, iid)) return iid;
+  }
+  return -1;
+}
+
+// per_positive comparisons (user, positive, sampled negative) per positive, grouped by user;
+// the solvers draw fresh negatives for them as they go. A slot without a negative (sample
+// failed) starts as (user, positive, positive), which contributes nothing until it gets one.
+void ImplicitFeedback::fill(Problem& prob, int per_positive, unsigned seed) const {
+  per_positive = std::max(per_positive, 1);
+  prob.train.resize(items.size() * per_positive);
+  prob.weight.clear();
+  prob.tridx.resize(n_users+1);
+  for(int uid=0; uid<=n_users; ++uid) prob.tridx[uid] = ptr[uid] * per_positive;
+
+  std::mt19937 gen(seed);
+  for(int uid=0; uid<n_users; ++uid) {
+    for(long long e=ptr[uid]; e<ptr[uid+1]; ++e)
+      for(int k=0; k<per_positive; ++k) {
+        int neg = sample(uid, gen);
+        prob.train[e * per_positive + k] = comparison(uid, items[e], (neg >= 0) ? neg : items[e], 1);
+      }
+  }
+
+  prob.n_users = n_users;
+  prob.n_items = n_items;
+  prob.n_train_comps = prob.train.size();
+  prob.implicit = this;
+}
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef __INGEST_HPP__
+#define __INGEST_HPP__
+
+#include <random>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_set>
+
+#include "elements.hpp"
+#include "ratings.hpp"
+#include "problem.hpp"
+
+// Train/test split of (user, item, rating) triples and comparison generation,
+// replacing util/num2comp.py and util/bin2comp.py.
+// Every user draws from its own generator seeded by (seed, user), so the result
+// does not depend on the number of threads.
+struct ingest_option {
+  // numeric : users with at least n_train + n_test ratings are kept,
+  //           n_train random ratings per user become comparisons, the rest is the test set
+  int      n_train = 50;
+  int      n_test  = 10;
+
+  // binary  : each (user, item) pair goes to training with probability f_train, to test with f_test,
+  //           and n_comps (positive, unobserved) comparisons are sampled per user
+  double   f_train = .9;
+  double   f_test  = .1;
+  int      n_comps = 1000;
+
+  unsigned seed    = 1;
+};
+
+class RatingIngest {
+  public:
+    int n_users, n_items;                 // largest user / item id in the triples file
+    std::vector<rating> triples;          // grouped by user, sorted by item
+    std::vector<int>    idx;
+
+    RatingIngest() : n_users(0), n_items(0) {}
+
+    void read_triples(const std::string&);
+    void split_numeric(const ingest_option&, Problem&, RatingMatrix&, RatingMatrix&);
+    void split_binary(const ingest_option&, Problem&, std::vector<std::unordered_set<int> >&, std::vector<std::unordered_set<int> >&);
+};
+
+void RatingIngest::read_triples(const std::string& filename) {
+
+  std::ifstream f(filename, std::ios::in | std::ios::binary);
+  if (!f.is_open()) {
+    printf("Error in opening the ratings file!\n");
+    std::cout << filename << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::string buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  f.close();
+
+  // parse "user item [rating]" lines, ids 1-based; a missing rating counts as 1, blank lines are skipped
+  std::vector<rating> parsed;
+  n_users = n_items = 0;
+
+  const char *p = buf.c_str(), *end = p + buf.size();
+  for(long long line=1; p < end; ++line) {
+    const char *eol = p;
+    while ((eol < end) && (*eol != '\n')) ++eol;
+    std::string text(p, eol);
+    p = eol + 1;
+    if (text.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+    char *q;
+    const char *t = text.c_str();
+    long uid = strtol(t, &q, 10);
+    bool valid = (q != t);
+    t = q;
+    long iid = strtol(t, &q, 10);
+    valid = valid && (q != t);
+    t = q;
+
+    double sc = 1.;
+    while ((*t == ' ') || (*t == '\t')) ++t;
+    if (valid && (*t != '\0') && (*t != '\r')) {
+      sc = strtod(t, &q);
+      valid = (q != t);
+      for(t = q; (*t == ' ') || (*t == '\t') || (*t == '\r'); ++t);
+      valid = valid && (*t == '\0');
+    }
+
+    if (!valid || (uid < 1) || (iid < 1) || (uid > INT_MAX) || (iid > INT_MAX)) {
+      printf("Error in the ratings file at line %lld : expected \"user item [rating]\" with ids >= 1!\n", line);
+      exit(EXIT_FAILURE);
+    }
+
+    n_users = std::max(n_users, (int)uid);
+    n_items = std::max(n_items, (int)iid);
+    parsed.push_back(rating(uid-1, iid-1, sc));
+  }
+
+  // group by user (counting sort), then sort each user by item
+  idx.assign(n_users+1, 0);
+  for(int i=0; i<parsed.size(); ++i) ++idx[parsed[i].user_id+1];
+  for(int uid=0; uid<n_users; ++uid) idx[uid+1] += idx[uid];
+
+  std::vector<int> pos(idx.begin(), idx.end()-1);
+  triples.resize(parsed.size());
+  for(int i=0; i<parsed.size(); ++i) triples[pos[parsed[i].user_id]++] = parsed[i];
+
+  #pragma omp parallel for schedule(dynamic,64)
+  for(int uid=0; uid<n_users; ++uid) std::sort(triples.begin()+idx[uid], triples.begin()+idx[uid+1], rating_userwise);
+
+  printf("%d users, %d items, %d ratings\n", n_users, n_items, (int)triples.size());
+}
+
+void RatingIngest::split_numeric(const ingest_option& opt, Problem& prob, RatingMatrix& train, RatingMatrix& test) {
+
+  // kept users are renumbered consecutively
+  std::vector<int> new_uid(n_users, -1);
+  int n_kept = 0;
+  for(int uid=0; uid<n_users; ++uid) {
+    if (idx[uid+1] - idx[uid] >= opt.n_train + opt.n_test) new_uid[uid] = n_kept++;
+  }
+
+  std::vector<int> train_cnt(n_kept+1, 0), test_cnt(n_kept+1, 0), comps_cnt(n_kept+1, 0);
+  std::vector<std::vector<rating> > split(n_kept);
+
+  #pragma omp parallel for schedule(dynamic,64)
+  for(int uid=0; uid<n_users; ++uid) {
+    int u = new_uid[uid];
+    if (u < 0) continue;
+
+    std::vector<rating>& r = split[u];
+    r.assign(triples.begin()+idx[uid], triples.begin()+idx[uid+1]);
+    for(int i=0; i<r.size(); ++i) r[i].user_id = u;
+
+    std::mt19937 gen(opt.seed + (unsigned)uid * 2654435761u);
+    std::shuffle(r.begin(), r.end(), gen);
+    std::sort(r.begin(), r.begin()+opt.n_train, rating_userwise);
+    std::sort(r.begin()+opt.n_train, r.end(), rating_userwise);
+
+    int n_comps = 0;
+    for(int i=0; i<opt.n_train; ++i)
+      for(int j=i+1; j<opt.n_train; ++j)
+        if (r[i].score != r[j].score) ++n_comps;
+
+    train_cnt[u+1] = opt.n_train;
+    test_cnt[u+1]  = r.size() - opt.n_train;
+    comps_cnt[u+1] = n_comps;
+  }
+
+  for(int u=0; u<n_kept; ++u) {
+    train_cnt[u+1] += train_cnt[u];
+    test_cnt[u+1]  += test_cnt[u];
+    comps_cnt[u+1] += comps_cnt[u];
+  }
+
+  prob.train.resize(comps_cnt[n_kept]);
+  train.ratings.resize(train_cnt[n_kept]);
+  test.ratings.resize(test_cnt[n_kept]);
+
+  int n_train_items = 0, n_test_items = 0;
+
+  #pragma omp parallel for schedule(dynamic,64) reduction(max:n_train_items,n_test_items)
+  for(int u=0; u<n_kept; ++u) {
+    std::vector<rating>& r = split[u];
+
+    int c = comps_cnt[u];
+    for(int i=0; i<opt.n_train; ++i) {
+      for(int j=i+1; j<opt.n_train; ++j) {
+        if (r[i].score > r[j].score) prob.train[c++] = comparison(u, r[i].item_id, r[j].item_id, 1);
+        if (r[i].score < r[j].score) prob.train[c++] = comparison(u, r[j].item_id, r[i].item_id, 1);
+      }
+    }
+    std::sort(prob.train.begin()+comps_cnt[u], prob.train.begin()+comps_cnt[u+1], comp_userwise);
+    for(int i=comps_cnt[u]; i<comps_cnt[u+1]; ++i)
+      n_train_items = std::max(n_train_items, std::max(prob.train[i].item1_id, prob.train[i].item2_id)+1);
+
+    for(int i=0; i<opt.n_train; ++i) train.ratings[train_cnt[u]+i] = r[i];
+    for(int i=opt.n_train; i<r.size(); ++i) {
+      test.ratings[test_cnt[u]+i-opt.n_train] = r[i];
+      n_test_items = std::max(n_test_items, r[i].item_id+1);
+    }
+
+    std::vector<rating>().swap(r);
+  }
+
+  prob.tridx         = comps_cnt;
+  prob.n_users       = n_kept;
+  prob.n_items       = n_train_items;
+  prob.n_train_comps = prob.train.size();
+
+  train.idx     = train_cnt;
+  train.n_users = n_kept;
+  train.n_items = n_items;
+
+  test.idx      = test_cnt;
+  test.n_users  = n_kept;
+  test.n_items  = n_test_items;
+
+  printf("%d users, %d items, %d comparisons, %d test ratings\n", prob.n_users, prob.n_items, prob.n_train_comps, (int)test.ratings.size());
+}
+
+void RatingIngest::split_binary(const ingest_option& opt, Problem& prob, std::vector<std::unordered_set<int> >& train, std::vector<std::unordered_set<int> >& test) {
+
+  train.assign(n_users, std::unordered_set<int>());
+  test.assign(n_users, std::unordered_set<int>());
+
+  std::vector<int> comps_cnt(n_users+1, 0);
+
+  #pragma omp parallel for schedule(dynamic,64)
+  for(int uid=0; uid<n_users; ++uid) {
+    std::mt19937 gen(opt.seed + (unsigned)uid * 2654435761u);
+    std::uniform_real_distribution<double> unif(0., 1.);
+
+    for(int i=idx[uid]; i<idx[uid+1]; ++i) {
+      double r = unif(gen);
+      if (r < opt.f_train) train[uid].insert(triples[i].item_id);
+      else if (r < opt.f_train + opt.f_test) test[uid].insert(triples[i].item_id);
+    }
+
+    if ((train[uid].size() > 0) && (train[uid].size() < n_items)) comps_cnt[uid+1] = opt.n_comps;
+  }
+
+  for(int uid=0; uid<n_users; ++uid) comps_cnt[uid+1] += comps_cnt[uid];
+  prob.train.resize(comps_cnt[n_users]);
+
+  #pragma omp parallel for schedule(dynamic,64)
+  for(int uid=0; uid<n_users; ++uid) {
+    if (comps_cnt[uid+1] == comps_cnt[uid]) continue;
+
+    std::vector<int> left(train[uid].begin(), train[uid].end());
+    std::sort(left.begin(), left.end());
+
+    // comparisons (training item, item not in the training set of the user)
+    std::mt19937 gen(opt.seed + 1 + (unsigned)uid * 2654435761u);
+    std::uniform_int_distribution<int> randleft(0, left.size()-1);
+    std::uniform_int_distribution<int> randitem(0, n_items-1);
+    for(int c=comps_cnt[uid]; c<comps_cnt[uid+1]; ++c) {
+      int right;
+      do { right = randitem(gen); } while (train[uid].find(right) != train[uid].end());
+      prob.train[c] = comparison(uid, left[randleft(gen)], right, 1);
+    }
+
+    std::sort(prob.train.begin()+comps_cnt[uid], prob.train.begin()+comps_cnt[uid+1], comp_userwise);
+  }
+
+  prob.tridx         = comps_cnt;
+  prob.n_users       = n_users;
+  prob.n_items       = n_items;
+  prob.n_train_comps = prob.train.size();
+
+  printf("%d users, %d items, %d comparisons\n", prob.n_users, prob.n_items, prob.n_train_comps);
+}
+
+// (user, item) pairs in the format read by EvaluatorBinary
+void write_pairs(const std::vector<std::unordered_set<int> >& pairs, const std::string& filename) {
+  FILE *f = fopen(filename.c_str(), "w");
+  if (f == NULL) {
+    printf("Error in opening the output file!\n");
+    exit(EXIT_FAILURE);
+  }
+  for(int uid=0; uid<pairs.size(); ++uid) {
+    std::vector<int> items(pairs[uid].begin(), pairs[uid].end());
+    std::sort(items.begin(), items.end());
+    for(int i=0; i<items.size(); ++i) fprintf(f, "%d %d\n", uid+1, items[i]+1);
+  }
+  fclose(f);
+}
+
+#endif
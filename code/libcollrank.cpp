@@ -0,0 +1,236 @@
+// libcollrank : the solvers behind the C API of collrank.h, built as one translation unit
+// (make lib), so that the header-only implementation is linked exactly once.
+#include <omp.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "collrank.h"
+#include "problem.hpp"
+#include "model.hpp"
+#include "scoring.hpp"
+#include "solver/altsvm.hpp"
+#include "solver/sgd.hpp"
+#include "solver/global.hpp"
+#include "solver/alsrank.hpp"
+
+static thread_local std::string last_error;
+
+static int fail(const std::string& msg) {
+  last_error = msg;
+  return -1;
+}
+
+// dual coordinate descent on the U-step of a single user, V fixed
+class SolverFoldIn : public SolverAltSVM {
+  public:
+    SolverFoldIn() : SolverAltSVM(INIT_PREDETERMINED, 1) {}
+
+    void fold_in(Problem& prob, Model& model, int sweeps) {
+      use_objective(prob);
+      std::vector<double> alphaU(prob.n_train_comps, 0.);
+      memset(model.U, 0, sizeof(double) * model.rank);
+
+      std::mt19937 gen(init_seed);
+      std::uniform_int_distribution<int> randidx(0, prob.n_train_comps-1);
+      for(long long n_updates=0; n_updates<(long long)sweeps * prob.n_train_comps; ++n_updates) {
+        dcd_step_U(prob, model, alphaU.data(), randidx(gen), 1./lambda);
+      }
+    }
+};
+
+static bool parse_options(const collrank_options *opt, loss_option_t& loss, stepsize_option_t& stepsize) {
+  std::string l = (opt->loss != NULL) ? opt->loss : "l2hinge";
+  if (l == "l1hinge") loss = L1_HINGE;
+  else if (l == "l2hinge") loss = L2_HINGE;
+  else if (l == "logistic") loss = LOGISTIC;
+  else if (l == "squared") loss = SQUARED;
+  else { last_error = "unknown loss " + l; return false; }
+
+  std::string s = (opt->stepsize != NULL) ? opt->stepsize : "schedule";
+  if (s == "schedule") stepsize = STEP_SCHEDULE;
+  else if (s == "adagrad") stepsize = STEP_ADAGRAD;
+  else if (s == "rmsprop") stepsize = STEP_RMSPROP;
+  else if (s == "adam") stepsize = STEP_ADAM;
+  else { last_error = "unknown stepsize " + s; return false; }
+
+  return true;
+}
+
+// group the comparisons by user (stable), as the solvers expect
+static bool build_problem(const collrank_comparison *comps, long long n, int n_users, int n_items, Problem& prob) {
+  prob.tridx.assign(n_users+1, 0);
+  for(long long i=0; i<n; ++i) {
+    const collrank_comparison& c = comps[i];
+    if ((c.user < 0) || (c.user >= n_users) || (c.item1 < 0) || (c.item1 >= n_items) || (c.item2 < 0) || (c.item2 >= n_items)) {
+      last_error = "comparison " + std::to_string(i) + " out of range";
+      return false;
+    }
+    ++prob.tridx[c.user+1];
+  }
+  for(int uid=0; uid<n_users; ++uid) prob.tridx[uid+1] += prob.tridx[uid];
+
+  prob.train.resize(n);
+  std::vector<int> pos(prob.tridx.begin(), prob.tridx.end()-1);
+  for(long long i=0; i<n; ++i) prob.train[pos[comps[i].user]++] = comparison(comps[i].user, comps[i].item1, comps[i].item2, 1);
+
+  prob.n_users = n_users;
+  prob.n_items = n_items;
+  prob.n_train_comps = n;
+  return true;
+}
+
+extern "C" {
+
+void collrank_default_options(collrank_options *opt) {
+  opt->algorithm      = "altsvm";
+  opt->loss           = "l2hinge";
+  opt->stepsize       = "schedule";
+  opt->lambda         = 1000.;
+  opt->stepsize_alpha = .1;
+  opt->stepsize_beta  = 1e-5;
+  opt->tol            = 1e-5;
+  opt->max_iter       = 10;
+  opt->n_threads      = 1;
+  opt->init           = 0;
+  opt->seed           = 1;
+}
+
+const char* collrank_last_error(void) {
+  return last_error.c_str();
+}
+
+int collrank_train(const collrank_comparison *comps, long long n, int n_users, int n_items, int rank,
+                   double *U, double *V, const collrank_options *opt,
+                   collrank_progress_fn progress, void *user_data) {
+  collrank_options defaults;
+  collrank_default_options(&defaults);
+  if (opt == NULL) opt = &defaults;
+
+  if ((n <= 0) || (n_users <= 0) || (n_items <= 0) || (rank <= 0) || (U == NULL) || (V == NULL))
+    return fail("empty problem or missing factor buffers");
+
+  loss_option_t loss;
+  stepsize_option_t stepsize;
+  if (!parse_options(opt, loss, stepsize)) return -1;
+
+  init_option_t init;
+  if (opt->init == 0) init = INIT_RANDOM;
+  else if (opt->init == 1) init = INIT_SVD;
+  else if (opt->init == 2) init = INIT_PREDETERMINED;
+  else return fail("unknown init option");
+
+  Problem prob(loss, opt->lambda);
+  if (!build_problem(comps, n, n_users, n_items, prob)) return -1;
+
+  Model model(rank);
+  model.wrap(n_users, n_items, U, V);
+
+  int n_threads = std::max(opt->n_threads, 1);
+  std::string algo = (opt->algorithm != NULL) ? opt->algorithm : "altsvm";
+  Solver *solver;
+  if (algo == "altsvm")
+    solver = new SolverAltSVM(init, n_threads, opt->max_iter);
+  else if (algo == "sgd")
+    solver = new SolverSGD(opt->stepsize_alpha, opt->stepsize_beta, stepsize, init, n_threads, opt->max_iter);
+  else if (algo == "global")
+    solver = new SolverGlobal(init, n_threads, opt->max_iter);
+  else if ((algo == "alsrank") && (loss == SQUARED))
+    solver = new SolverALSRank(init, n_threads, opt->max_iter);
+  else if (algo == "alsrank")
+    return fail("alsrank needs the squared loss");
+  else
+    return fail("unknown algorithm " + algo);
+
+  solver->set_verbose(false);
+  solver->set_stopping(opt->tol, 0);
+  solver->set_seed(opt->seed);
+  if (progress != NULL)
+    solver->set_progress([progress, user_data](int iter, double time, double f) { return progress(iter, time, f, user_data) != 0; });
+
+  int saved_threads = omp_get_max_threads();
+  omp_set_num_threads(n_threads);
+  solver->solve(prob, model, NULL);
+  omp_set_num_threads(saved_threads);
+
+  delete solver;
+  return 0;
+}
+
+int collrank_fold_in(const collrank_comparison *comps, long long n, const double *V, int n_items, int rank,
+                     const collrank_options *opt, int sweeps, double *u) {
+  collrank_options defaults;
+  collrank_default_options(&defaults);
+  if (opt == NULL) opt = &defaults;
+
+  if ((n <= 0) || (n_items <= 0) || (rank <= 0) || (V == NULL) || (u == NULL))
+    return fail("empty problem or missing factor buffers");
+
+  loss_option_t loss;
+  stepsize_option_t stepsize;
+  if (!parse_options(opt, loss, stepsize)) return -1;
+  if ((loss != L1_HINGE) && (loss != L2_HINGE)) return fail("fold-in supports hinge losses only");
+
+  // all comparisons belong to user 0 of a one-user problem
+  std::vector<collrank_comparison> own(comps, comps + n);
+  for(long long i=0; i<n; ++i) own[i].user = 0;
+
+  Problem prob(loss, opt->lambda);
+  if (!build_problem(own.data(), n, 1, n_items, prob)) return -1;
+
+  Model model(rank);
+  model.wrap(1, n_items, u, const_cast<double*>(V));
+
+  SolverFoldIn solver;
+  solver.set_seed(opt->seed);
+  solver.fold_in(prob, model, std::max(sweeps, 1));
+  return 0;
+}
+
+void collrank_score(const double *U, const double *V, int rank,
+                    const int *users, const int *items, long long n, double *out) {
+  #pragma omp parallel for
+  for(long long i=0; i<n; ++i) {
+    const double *u = &U[(size_t)users[i] * rank], *v = &V[(size_t)items[i] * rank];
+    double s = 0.;
+    for(int k=0; k<rank; ++k) s += u[k] * v[k];
+    out[i] = s;
+  }
+}
+
+int collrank_topk(const double *U, const double *V, int n_users, int n_items, int rank,
+                  const int *users, int n, int k, const long long *seen_ptr, const int *seen_items,
+                  int n_threads, int *out_items, double *out_scores) {
+  if ((k <= 0) || (rank <= 0) || (U == NULL) || (V == NULL)) return fail("invalid top-K arguments");
+  for(int i=0; i<n; ++i)
+    if ((users[i] < 0) || (users[i] >= n_users)) return fail("user " + std::to_string(users[i]) + " out of range");
+
+  Model model(rank);
+  model.wrap(n_users, n_items, const_cast<double*>(U), const_cast<double*>(V));
+
+  const int block = 64, tile = 1024;
+  int n_blocks = (n + block - 1) / block;
+
+  #pragma omp parallel num_threads(std::max(n_threads, 1))
+  {
+    std::vector<double> scores;
+    std::vector<std::vector<std::pair<double, int> > > heaps;
+
+    #pragma omp for schedule(dynamic)
+    for(int bl=0; bl<n_blocks; ++bl) {
+      int b0 = bl * block, n_block = std::min(block, n - b0);
+      topk_block(model, &users[b0], n_block, k, seen_ptr, seen_items, tile, scores, heaps);
+      for(int b=0; b<n_block; ++b) {
+        for(int j=0; j<k; ++j) {
+          bool has = (j < heaps[b].size());
+          out_items[(size_t)(b0+b) * k + j]  = has ? heaps[b][j].second : -1;
+          out_scores[(size_t)(b0+b) * k + j] = has ? heaps[b][j].first : 0.;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+}
@@ -0,0 +1,158 @@
+#ifndef __LINALG_HPP__
+#define __LINALG_HPP__
+
+#include <omp.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// Small dense helpers for the randomized SVD initialization and the Newton steps.
+// Matrices are row-major; tall matrices (n x l) are long in n and narrow in l.
+
+// Reductions over the rows are summed in blocks of a fixed size and the block sums added in
+// block order, so that the results do not depend on the number of threads.
+const long long reduction_block = 4096;
+
+// sum of A[i*l+p] * B[i*l+q] over the rows i of the n x l matrices A and B
+double column_dot(const double *A, const double *B, long long n, int l, int p, int q) {
+  long long n_blocks = (n + reduction_block - 1) / reduction_block;
+  std::vector<double> partial(n_blocks);
+
+  #pragma omp parallel for schedule(static)
+  for(long long b=0; b<n_blocks; ++b) {
+    double s = 0.;
+    for(long long i=b*reduction_block; i<std::min(n, (b+1)*reduction_block); ++i) s += A[i*l+p] * B[i*l+q];
+    partial[b] = s;
+  }
+
+  double s = 0.;
+  for(long long b=0; b<n_blocks; ++b) s += partial[b];
+  return s;
+}
+
+// orthonormalize the columns of the n x l matrix A in place (modified Gram-Schmidt);
+// a column that is numerically dependent on the previous ones is set to zero
+void orthonormalize_columns(double *A, long long n, int l) {
+  for(int j=0; j<l; ++j) {
+    for(int p=0; p<j; ++p) {
+      double dot = column_dot(A, A, n, l, p, j);
+
+      #pragma omp parallel for
+      for(long long i=0; i<n; ++i) A[i*l+j] -= dot * A[i*l+p];
+    }
+
+    double normsq = column_dot(A, A, n, l, j, j);
+
+    double scale = (normsq > 1e-24) ? 1. / sqrt(normsq) : 0.;
+    #pragma omp parallel for
+    for(long long i=0; i<n; ++i) A[i*l+j] *= scale;
+  }
+}
+
+// C (l x l) = A^T B for n x l matrices A and B
+void gram(const double *A, const double *B, long long n, int l, double *C) {
+  long long n_blocks = (n + reduction_block - 1) / reduction_block;
+  std::vector<double> partial(n_blocks * l * l, 0.);
+
+  #pragma omp parallel for schedule(static)
+  for(long long b=0; b<n_blocks; ++b) {
+    double *C_block = &partial[b * l * l];
+    for(long long i=b*reduction_block; i<std::min(n, (b+1)*reduction_block); ++i)
+      for(int p=0; p<l; ++p)
+        for(int q=0; q<l; ++q) C_block[p*l+q] += A[i*l+p] * B[i*l+q];
+  }
+
+  std::fill(C, C+l*l, 0.);
+  for(long long b=0; b<n_blocks; ++b)
+    for(int p=0; p<l*l; ++p) C[p] += partial[b * l * l + p];
+}
+
+// Eigen-decomposition of the symmetric l x l matrix A by cyclic Jacobi rotations.
+// On return, eval holds the eigenvalues in decreasing order and column j of evec (l x l)
+// the eigenvector of eval[j]. A is overwritten.
+void symmetric_eigen(double *A, int l, double *eval, double *evec) {
+  std::vector<double> W(l*l, 0.);
+  for(int p=0; p<l; ++p) W[p*l+p] = 1.;
+
+  for(int sweep=0; sweep<100; ++sweep) {
+    double off = 0., total = 0.;
+    for(int p=0; p<l; ++p)
+      for(int q=0; q<l; ++q) { total += A[p*l+q] * A[p*l+q]; if (p != q) off += A[p*l+q] * A[p*l+q]; }
+    if (off <= 1e-30 * total) break;
+
+    for(int p=0; p<l-1; ++p) {
+      for(int q=p+1; q<l; ++q) {
+        if (A[p*l+q] == 0.) continue;
+
+        double theta = (A[q*l+q] - A[p*l+p]) / (2. * A[p*l+q]);
+        double t = ((theta >= 0.) ? 1. : -1.) / (fabs(theta) + sqrt(theta*theta + 1.));
+        double c = 1. / sqrt(t*t + 1.), s = t * c;
+
+        for(int k=0; k<l; ++k) {
+          double akp = A[k*l+p], akq = A[k*l+q];
+          A[k*l+p] = c * akp - s * akq;
+          A[k*l+q] = s * akp + c * akq;
+        }
+        for(int k=0; k<l; ++k) {
+          double apk = A[p*l+k], aqk = A[q*l+k];
+          A[p*l+k] = c * apk - s * aqk;
+          A[q*l+k] = s * apk + c * aqk;
+        }
+        for(int k=0; k<l; ++k) {
+          double wkp = W[k*l+p], wkq = W[k*l+q];
+          W[k*l+p] = c * wkp - s * wkq;
+          W[k*l+q] = s * wkp + c * wkq;
+        }
+      }
+    }
+  }
+
+  std::vector<int> order(l);
+  for(int j=0; j<l; ++j) order[j] = j;
+  std::sort(order.begin(), order.end(), [A, l](int a, int b) { return A[a*l+a] > A[b*l+b]; });
+
+  for(int j=0; j<l; ++j) {
+    eval[j] = A[order[j]*l+order[j]];
+    for(int k=0; k<l; ++k) evec[k*l+j] = W[k*l+order[j]];
+  }
+}
+
+// Cholesky factorization A = L L^T of the symmetric positive definite l x l matrix A, in place
+// (L in the lower triangle). Returns false if A is not positive definite.
+bool cholesky_factor(double *A, int l) {
+  for(int j=0; j<l; ++j) {
+    double d = A[j*l+j];
+    for(int k=0; k<j; ++k) d -= A[j*l+k] * A[j*l+k];
+    if (d <= 0.) return false;
+    d = sqrt(d);
+    A[j*l+j] = d;
+    for(int i=j+1; i<l; ++i) {
+      double a = A[i*l+j];
+      for(int k=0; k<j; ++k) a -= A[i*l+k] * A[j*l+k];
+      A[i*l+j] = a / d;
+    }
+  }
+  return true;
+}
+
+// solve L L^T x = b in place (b becomes x) with the factor of cholesky_factor
+void cholesky_substitute(const double *L, int l, double *b) {
+  for(int i=0; i<l; ++i) {
+    for(int k=0; k<i; ++k) b[i] -= L[i*l+k] * b[k];
+    b[i] /= L[i*l+i];
+  }
+  for(int i=l-1; i>=0; --i) {
+    for(int k=i+1; k<l; ++k) b[i] -= L[k*l+i] * b[k];
+    b[i] /= L[i*l+i];
+  }
+}
+
+// Solve A x = b in place (b becomes x); A is overwritten by its Cholesky factor.
+// Returns false if A is not positive definite.
+bool cholesky_solve(double *A, int l, double *b) {
+  if (!cholesky_factor(A, l)) return false;
+  cholesky_substitute(A, l, b);
+  return true;
+}
+
+#endif
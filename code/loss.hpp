@@ -19,14 +19,14 @@
 
 enum loss_option_t {L1_HINGE, L2_HINGE, LOGISTIC, SQUARED};
 
-// binary classification loss
-double compute_loss(const Model& model, const std::vector<comparison>& TestComps, loss_option_t option) {
+// binary classification loss, optionally weighted per comparison
+double compute_loss(const Model& model, const std::vector<comparison>& TestComps, loss_option_t option, const double *weight = NULL) {
   double p = 0.;
   #pragma omp parallel for reduction(+:p)
   for(int i=0; i<TestComps.size(); ++i) {
-    double *user_vec  = &(model.U[TestComps[i].user_id  * model.rank]);
-    double *item1_vec = &(model.V[TestComps[i].item1_id * model.rank]);
-    double *item2_vec = &(model.V[TestComps[i].item2_id * model.rank]);
+    double *user_vec  = &(model.U[(long long)TestComps[i].user_id  * model.rank]);
+    double *item1_vec = &(model.V[(long long)TestComps[i].item1_id * model.rank]);
+    double *item2_vec = &(model.V[(long long)TestComps[i].item2_id * model.rank]);
     double d = 0., loss;
     for(int j=0; j<model.rank; ++j) {
       d += user_vec[j] * (item1_vec[j] - item2_vec[j]);
@@ -46,7 +46,7 @@ double compute_loss(const Model& model, const std::vector<comparison>& TestComps
         loss = pow(std::max(0., 1.-d), 2.);
     }
 
-    p += loss;
+    p += (weight != NULL) ? weight[i] * loss : loss;
   }
      
   return p;		
@@ -62,9 +62,9 @@ double compute_loss_v2(const Model& model, std::vector<std::vector<int> >& Iu, s
         int iid1 = Iu[uid][idx1];
         int iid2 = noIu[uid][idx2];
 
-        double *user_vec  = &(model.U[uid  * model.rank]);
-        double *item1_vec = &(model.V[iid1 * model.rank]);
-        double *item2_vec = &(model.V[iid2 * model.rank]);
+        double *user_vec  = &(model.U[(long long)uid  * model.rank]);
+        double *item1_vec = &(model.V[(long long)iid1 * model.rank]);
+        double *item2_vec = &(model.V[(long long)iid2 * model.rank]);
 
         double d = 0., loss;
         for(int j=0; j<model.rank; ++j) {
@@ -89,8 +89,8 @@ double compute_loss(const Model& model, const RatingMatrix& test) {
   double p = 0.;
   #pragma omp parallel for reduction(+:p) 
   for(int i=0; i<test.ratings.size(); ++i) {
-    double *user_vec  = &(model.U[test.ratings[i].user_id * model.rank]);
-    double *item_vec  = &(model.V[test.ratings[i].item_id * model.rank]);
+    double *user_vec  = &(model.U[(long long)test.ratings[i].user_id * model.rank]);
+    double *item_vec  = &(model.V[(long long)test.ratings[i].item_id * model.rank]);
     double d = 0.;
     for(int j=0; j<model.rank; ++j) d += user_vec[j] * item_vec[j];
     p += .5 * pow(test.ratings[i].score - d, 2.);
@@ -138,62 +138,83 @@ double compute_pairwiseError(const RatingMatrix& TestRating, const RatingMatrix&
   return sum_error / (double)TestRating.n_users; 
 }
 
-double compute_pairwiseError(const RatingMatrix& TestRating, const Model& PredictedModel) {
-
-  double sum_error = 0.;
-  #pragma omp parallel for reduction(+:sum_error) 
-  for(int uid=0; uid<TestRating.n_users; ++uid) {
-    std::vector<double> score(TestRating.n_items,-1e10);
-    //double max_sc = -1.;
-
-    for(int i=TestRating.idx[uid]; i<TestRating.idx[uid+1]; ++i) {
-      int iid = TestRating.ratings[i].item_id;
-      
-      if (iid < PredictedModel.n_items) {
-        double prod = 0.;
-        for(int k=0; k<PredictedModel.rank; ++k) prod += PredictedModel.U[uid * PredictedModel.rank + k] * PredictedModel.V[iid * PredictedModel.rank + k];
-        score[iid] = prod;
-      }
-      else {
-        score[iid] = -1e10;
+// number of pairs i < j with a[i] < a[j] (strictly), by merge sort; a is sorted on return
+unsigned long long count_ascending_pairs(double *a, double *tmp, int n) {
+  unsigned long long count = 0;
+  for(int width=1; width<n; width*=2) {
+    for(int from=0; from<n-width; from+=2*width) {
+      int mid = from+width, to = std::min(from+2*width, n);
+      int i = from, j = mid, t = from;
+      while ((i < mid) && (j < to)) {
+        if (a[i] < a[j]) tmp[t++] = a[i++];
+        else { count += i-from; tmp[t++] = a[j++]; }
       }
+      while (i < mid) tmp[t++] = a[i++];
+      while (j < to) { count += mid-from; tmp[t++] = a[j++]; }
+      for(t=from; t<to; ++t) a[t] = tmp[t];
+    }
+  }
+  return count;
+}
 
-//      if (TestRating.ratings[i].score > max_sc) max_sc = TestRating.ratings[i].score;
+// predicted scores of the test ratings of a user, -1e10 for items the model does not know
+void compute_user_scores(const RatingMatrix& TestRating, const Model& PredictedModel, int uid, std::vector<double>& score) {
+  score.clear();
+  for(int i=TestRating.idx[uid]; i<TestRating.idx[uid+1]; ++i) {
+    int iid = TestRating.ratings[i].item_id;
+
+    if (iid < PredictedModel.n_items) {
+      double prod = 0.;
+      for(int k=0; k<PredictedModel.rank; ++k) prod += PredictedModel.U[(long long)uid * PredictedModel.rank + k] * PredictedModel.V[(long long)iid * PredictedModel.rank + k];
+      score.push_back(prod);
     }
+    else {
+      score.push_back(-1e10);
+    }
+  }
+}
 
-//    max_sc = max_sc - .1;
+// A pair of test items with different ratings is an error unless the predicted scores are
+// strictly ordered the same way. After sorting by (rating ascending, score descending), the
+// correctly ordered pairs are exactly the strictly ascending pairs of the score sequence.
+// sc and tmp are scratch space.
+double compute_user_pairwiseError(const RatingMatrix& TestRating, const Model& PredictedModel, int uid, 
+                                  std::vector<std::pair<double,double> >& buf, std::vector<double>& sc, std::vector<double>& tmp) {
+  int n = TestRating.idx[uid+1] - TestRating.idx[uid];
+
+  compute_user_scores(TestRating, PredictedModel, uid, sc);
+  buf.resize(n);
+  for(int i=0; i<n; ++i) buf[i] = std::make_pair(TestRating.ratings[TestRating.idx[uid]+i].score, -sc[i]);
+  std::sort(buf.begin(), buf.end());
+
+  unsigned long long n_comps_this = (unsigned long long)n * (n-1) / 2, n_tied = 0;
+  for(int i=0, j=0; i<n; i=j) {
+    while ((j < n) && (buf[j].first == buf[i].first)) ++j;
+    n_tied += (unsigned long long)(j-i) * (j-i-1) / 2;
+  }
 
-    unsigned long long error_this = 0, n_comps_this = 0;
-    for(int i=TestRating.idx[uid]; i<TestRating.idx[uid+1]-1; ++i) {
-      for(int j=i+1; j<TestRating.idx[uid+1]; ++j) {
-        int item1_id = TestRating.ratings[i].item_id;
-        int item2_id = TestRating.ratings[j].item_id; 
-        double item1_sc = TestRating.ratings[i].score;
-        double item2_sc = TestRating.ratings[j].score;      
+  tmp.resize(n);
+  for(int i=0; i<n; ++i) sc[i] = -buf[i].second;
+  unsigned long long n_correct = count_ascending_pairs(sc.data(), tmp.data(), n);
 
-        if ((item1_sc > item2_sc) && (score[item1_id] <= score[item2_id])) ++error_this;
-        if ((item1_sc < item2_sc) && (score[item1_id] >= score[item2_id])) ++error_this;
-        ++n_comps_this;
-/*
-        if ((item1_sc >= max_sc) && (item2_sc < max_sc)) {
-          if (score[item1_id] <= score[item2_id]) ++errorT;
-          ++n_compsT;
-        }
+  unsigned long long error_this = n_comps_this - n_tied - n_correct;
+  return (double)error_this / (double)n_comps_this;
+}
 
-        if ((item2_sc >= max_sc) && (item1_sc < max_sc)) {
-          if (score[item2_id] >= score[item1_id]) ++errorT;
-          ++n_compsT;
-        }
-*/    
-      }
-    }
+double compute_pairwiseError(const RatingMatrix& TestRating, const Model& PredictedModel) {
 
-    sum_error += (double)error_this / (double)n_comps_this;
+  double sum_error = 0.;
+  #pragma omp parallel reduction(+:sum_error)
+  {
+    std::vector<std::pair<double,double> > buf;       // (rating, predicted score) of the current user
+    std::vector<double> sc, tmp;
+
+    #pragma omp for schedule(dynamic,64)
+    for(int uid=0; uid<TestRating.n_users; ++uid) {
+      sum_error += compute_user_pairwiseError(TestRating, PredictedModel, uid, buf, sc, tmp);
+    }
   }
 
-  //comp_error.first  = (double)error / (double)n_comps;
-  //comp_error.second = (double)errorT / (double)n_compsT; 
-
   return sum_error / (double)TestRating.n_users; 
 }
 
@@ -278,34 +299,39 @@ double compute_ndcg(const RatingMatrix& TestRating, const RatingMatrix& Predicte
   return ndcg_sum / (double)PredictedRating.n_users;
 }
 
-double compute_ndcg(const RatingMatrix& TestRating, const Model& PredictedModel) {
- 
-  if (!TestRating.is_dcg_max_computed) return -1.; 
- 
-  double ndcg_sum = 0.;
-  std::vector<double> score;
+// mean NDCG over users at every cutoff of TestRating
+void compute_ndcg(const RatingMatrix& TestRating, const Model& PredictedModel, std::vector<double>& ndcg) {
 
-  for(int uid=0; uid<PredictedModel.n_users; ++uid) {
-    double dcg = 0.;
-  
-    score.clear();
-    for(int i=TestRating.idx[uid]; i<TestRating.idx[uid+1]; ++i) {
-      int iid = TestRating.ratings[i].item_id;
+  int n_cutoffs = TestRating.ndcg_cutoffs.size();
+  ndcg.assign(n_cutoffs, 0.);
+  if (!TestRating.is_dcg_max_computed) { ndcg.assign(n_cutoffs, -1.); return; }
 
-      if (iid < PredictedModel.n_items) {
-        double prod = 0.;
-        for(int k=0; k<PredictedModel.rank; ++k) prod += PredictedModel.U[uid * PredictedModel.rank + k] * PredictedModel.V[iid * PredictedModel.rank + k];
-        score.push_back(prod);
-      }
-      else {
-        score.push_back(-1e10);
-      }
+  #pragma omp parallel
+  {
+    std::vector<double> score, ndcg_user(n_cutoffs), ndcg_sum(n_cutoffs, 0.);
+    std::vector<int> order;
+
+    #pragma omp for schedule(dynamic,64)
+    for(int uid=0; uid<PredictedModel.n_users; ++uid) {
+      compute_user_scores(TestRating, PredictedModel, uid, score);
+      TestRating.compute_user_ndcg(uid, score, order, ndcg_user.data());
+      for(int c=0; c<n_cutoffs; ++c) ndcg_sum[c] += ndcg_user[c];
     }
-    
-    ndcg_sum += TestRating.compute_user_ndcg(uid, score);
-	}
 
-  return ndcg_sum / (double)PredictedModel.n_users;
+    #pragma omp critical
+    for(int c=0; c<n_cutoffs; ++c) ndcg[c] += ndcg_sum[c];
+  }
+
+  for(int c=0; c<n_cutoffs; ++c) ndcg[c] /= (double)PredictedModel.n_users;
+}
+
+// mean NDCG over users at the largest cutoff
+double compute_ndcg(const RatingMatrix& TestRating, const Model& PredictedModel) {
+  if (!TestRating.is_dcg_max_computed) return -1.; 
+
+  std::vector<double> ndcg;
+  compute_ndcg(TestRating, PredictedModel, ndcg);
+  return ndcg.back();
 }
 
 
@@ -0,0 +1,128 @@
+#ifndef __METRICS_HPP__
+#define __METRICS_HPP__
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <utility>
+#include <sys/resource.h>
+
+// Phase timers and counters, emitted as one JSON object per line.
+// Timers and counters accumulate until the next emit() and are reset by it.
+// Updates are serialized, so that concurrent solves (sweep mode) can share the object.
+class Metrics {
+  FILE *f = NULL;
+  double start;
+
+  std::vector<std::pair<std::string, double> >    timers;       // in order of first use
+  std::vector<std::pair<std::string, long long> > counters;
+
+  public:
+    bool enabled() const { return f != NULL; }
+
+    void open(const std::string&);
+    void close();
+
+    void add_time(const std::string&, double);
+    void add_count(const std::string&, long long);
+    double get_time(const std::string&) const;
+    long long get_count(const std::string&) const;
+
+    void emit(const std::string&, const std::vector<std::pair<std::string, double> >&);
+
+    static double peak_rss_mb();
+};
+
+Metrics metrics;
+
+// adds the lifetime of the object to the timer of the given phase
+class ScopedTimer {
+  const char* name;
+  double start;
+
+  public:
+    ScopedTimer(const char* n) : name(n), start(omp_get_wtime()) {}
+    ~ScopedTimer() { metrics.add_time(name, omp_get_wtime() - start); }
+};
+
+void Metrics::open(const std::string& filename) {
+  close();
+  f = fopen(filename.c_str(), "w");
+  if (f == NULL) {
+    printf("Error in opening the metrics file!\n");
+    exit(EXIT_FAILURE);
+  }
+  start = omp_get_wtime();
+}
+
+void Metrics::close() {
+  if (f != NULL) fclose(f);
+  f = NULL;
+}
+
+void Metrics::add_time(const std::string& name, double sec) {
+  if (!enabled()) return;
+  #pragma omp critical (metrics)
+  {
+    int i = 0;
+    while ((i < timers.size()) && (timers[i].first != name)) ++i;
+    if (i < timers.size()) timers[i].second += sec;
+    else timers.push_back(std::make_pair(name, sec));
+  }
+}
+
+void Metrics::add_count(const std::string& name, long long n) {
+  if (!enabled()) return;
+  #pragma omp critical (metrics)
+  {
+    int i = 0;
+    while ((i < counters.size()) && (counters[i].first != name)) ++i;
+    if (i < counters.size()) counters[i].second += n;
+    else counters.push_back(std::make_pair(name, n));
+  }
+}
+
+double Metrics::get_time(const std::string& name) const {
+  for(int i=0; i<timers.size(); ++i) if (timers[i].first == name) return timers[i].second;
+  return 0.;
+}
+
+long long Metrics::get_count(const std::string& name) const {
+  for(int i=0; i<counters.size(); ++i) if (counters[i].first == name) return counters[i].second;
+  return 0;
+}
+
+void Metrics::emit(const std::string& event, const std::vector<std::pair<std::string, double> >& fields) {
+  if (!enabled()) return;
+
+  #pragma omp critical (metrics)
+  {
+    fprintf(f, "{\"event\": \"%s\", \"wall_time\": %.6f", event.c_str(), omp_get_wtime() - start);
+    // JSON has no NaN or infinity
+    for(int i=0; i<fields.size(); ++i) {
+      if (std::isfinite(fields[i].second)) fprintf(f, ", \"%s\": %.10g", fields[i].first.c_str(), fields[i].second);
+      else fprintf(f, ", \"%s\": null", fields[i].first.c_str());
+    }
+
+    fprintf(f, ", \"seconds\": {");
+    for(int i=0; i<timers.size(); ++i) fprintf(f, "%s\"%s\": %.6f", (i > 0) ? ", " : "", timers[i].first.c_str(), timers[i].second);
+    fprintf(f, "}, \"counts\": {");
+    for(int i=0; i<counters.size(); ++i) fprintf(f, "%s\"%s\": %lld", (i > 0) ? ", " : "", counters[i].first.c_str(), counters[i].second);
+    fprintf(f, "}, \"peak_rss_mb\": %.1f}\n", peak_rss_mb());
+    fflush(f);
+
+    timers.clear();
+    counters.clear();
+  }
+}
+
+double Metrics::peak_rss_mb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (double)usage.ru_maxrss / 1024.;       // ru_maxrss is in kilobytes on Linux
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __MMAPFILE_HPP__
+#define __MMAPFILE_HPP__
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only memory mapping of a whole file, split into line-aligned chunks for parallel parsing
+class MappedFile {
+  int fd;
+
+  public:
+    const char *data;
+    size_t      size;
+
+    MappedFile() : fd(-1), data(NULL), size(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(const std::string&);
+    void close();
+
+    std::vector<size_t> line_chunks(int) const;
+};
+
+bool MappedFile::open(const std::string& filename) {
+  close();
+
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) { close(); return false; }
+  size = st.st_size;
+  if (size == 0) return true;
+
+  void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) { close(); return false; }
+  madvise(p, size, MADV_SEQUENTIAL);
+  data = (const char*)p;
+
+  return true;
+}
+
+void MappedFile::close() {
+  if (data != NULL) munmap((void*)data, size);
+  if (fd >= 0) ::close(fd);
+  data = NULL;
+  size = 0;
+  fd = -1;
+}
+
+// n_chunks+1 offsets; every chunk starts at the beginning of a line
+std::vector<size_t> MappedFile::line_chunks(int n_chunks) const {
+  std::vector<size_t> bound(n_chunks+1, size);
+  bound[0] = 0;
+  for(int c=1; c<n_chunks; ++c) {
+    size_t pos = std::max(bound[c-1], size * c / n_chunks);
+    while ((pos > bound[c-1]) && (pos < size) && (data[pos-1] != '\n')) ++pos;
+    bound[c] = pos;
+  }
+  return bound;
+}
+
+// Hand-written number parsers over [p, end). Leading blanks (not newlines) are skipped;
+// the returned pointer is p itself if no number was found.
+
+inline const char* skip_blanks(const char *p, const char *end) {
+  while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r'))) ++p;
+  return p;
+}
+
+inline const char* parse_int(const char *p, const char *end, int& v) {
+  const char *q = skip_blanks(p, end);
+  bool neg = false;
+  if ((q < end) && ((*q == '-') || (*q == '+'))) { neg = (*q == '-'); ++q; }
+  if ((q >= end) || (*q < '0') || (*q > '9')) return p;
+
+  int x = 0;
+  while ((q < end) && (*q >= '0') && (*q <= '9')) x = x*10 + (*q++ - '0');
+  v = neg ? -x : x;
+  return q;
+}
+
+// Correctly rounded : a mantissa of at most 15 significant digits with a decimal exponent of at
+// most 22 is exact in a double, and so is 10^e, so one multiplication or division rounds once
+// (Clinger's fast path); any other token goes through strtod.
+inline const char* parse_double(const char *p, const char *end, double& v) {
+  static const double pow10[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  const char *q = skip_blanks(p, end), *token = q;
+  bool neg = false;
+  if ((q < end) && ((*q == '-') || (*q == '+'))) { neg = (*q == '-'); ++q; }
+
+  long long m = 0;
+  int n_digits = 0, n_significant = 0, e = 0;
+  while ((q < end) && (*q >= '0') && (*q <= '9')) {
+    if ((n_significant > 0) || (*q != '0')) {
+      if (n_significant < 18) m = m*10 + (*q - '0'); else ++e;
+      ++n_significant;
+    }
+    ++n_digits; ++q;
+  }
+  if ((q < end) && (*q == '.')) {
+    ++q;
+    while ((q < end) && (*q >= '0') && (*q <= '9')) {
+      if ((n_significant > 0) || (*q != '0')) {
+        if (n_significant < 18) { m = m*10 + (*q - '0'); --e; }
+        ++n_significant;
+      }
+      else --e;
+      ++n_digits; ++q;
+    }
+  }
+  if (n_digits == 0) return p;
+
+  if ((q < end) && ((*q == 'e') || (*q == 'E'))) {
+    int x;
+    const char *r = parse_int(q+1, end, x);
+    if (r != q+1) { e += x; q = r; }
+  }
+
+  if ((n_significant <= 15) && (e >= -22) && (e <= 22)) {
+    double x = (double)m;
+    x = (e >= 0) ? x * pow10[e] : x / pow10[-e];
+    v = neg ? -x : x;
+    return q;
+  }
+
+  char buf[64];
+  size_t len = q - token;
+  if (len < sizeof(buf)) {
+    memcpy(buf, token, len);
+    buf[len] = 0;
+    v = strtod(buf, NULL);
+  }
+  else v = strtod(std::string(token, len).c_str(), NULL);
+  return q;
+}
+
+#endif
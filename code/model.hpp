@@ -2,8 +2,11 @@
 #define __MODEL_HPP__
 
 #include <fstream>
+#include "paging.hpp"
 
 class Model {
+  PagedRows *paged_U, *paged_V;    // file-backed U, V (NULL : on the heap)
+
   public:
     bool is_allocated;
     int n_users, n_items;           // number of users/items in training sample, number of samples in traing and testing data set
@@ -11,11 +14,18 @@ class Model {
     double *U, *V;                  // low rank U, V
 
     void allocate(int nu, int ni);    
+    bool allocate_paged(int nu, int ni, const std::string&, bool, size_t, size_t);
+    void wrap(int nu, int ni, double *u, double *v);   // use caller-owned U, V in place (never freed)
     void de_allocate();					    // deallocate U, V when they are used multiple times by different methods
 
-    Model(int r): is_allocated(false), rank(r) {}
-    Model(int nu, int ni, int r): is_allocated(false), rank(r) { allocate(nu, ni); }
+    Model(int r): paged_U(NULL), paged_V(NULL), is_allocated(false), rank(r) {}
+    Model(int nu, int ni, int r): paged_U(NULL), paged_V(NULL), is_allocated(false), rank(r) { allocate(nu, ni); }
  
+    bool is_paged() const { return (paged_V != NULL); }
+    void prefetch_users(const int *uids, int n) { if (paged_U != NULL) paged_U->prefetch(uids, n); }
+    void prefetch_items(const int *iids, int n) { if (paged_V != NULL) paged_V->prefetch(iids, n); }
+    void paging_stats(long long&, long long&) const;
+
     double Unormsq();
     double Vnormsq();
 
@@ -25,21 +35,21 @@ class Model {
 
 double Model::Unormsq() {
   double p = 0.;
-  for(int i=0; i<n_users*rank; ++i) p += U[i]*U[i];
+  for(long long i=0; i<(long long)n_users*rank; ++i) p += U[i]*U[i];
   return p;
 }
 
 double Model::Vnormsq() {
   double p = 0.;
-  for(int i=0; i<n_items*rank; ++i) p += V[i]*V[i];
+  for(long long i=0; i<(long long)n_items*rank; ++i) p += V[i]*V[i];
   return p;
 }
 
 void Model::allocate(int nu, int ni) {
   if (is_allocated) de_allocate();
 
-  U = new double[nu*rank];
-  V = new double[ni*rank];
+  U = new double[(long long)nu*rank];
+  V = new double[(long long)ni*rank];
 
   n_users = nu;
   n_items = ni;
@@ -47,11 +57,62 @@ void Model::allocate(int nu, int ni) {
   is_allocated = true;
 }
 
+// V (and U when page_users) in the files prefix.V (prefix.U), with a working set of about
+// budget_bytes per factor in chunks of about chunk_bytes; false if a file cannot be mapped
+bool Model::allocate_paged(int nu, int ni, const std::string& prefix, bool page_users, size_t budget_bytes, size_t chunk_bytes) {
+  if (is_allocated) de_allocate();
+
+  paged_V = new PagedRows;
+  if (!paged_V->open(prefix + ".V", ni, rank, budget_bytes, chunk_bytes)) {
+    delete paged_V;
+    paged_V = NULL;
+    return false;
+  }
+  V = paged_V->data;
+
+  if (page_users) {
+    paged_U = new PagedRows;
+    if (!paged_U->open(prefix + ".U", nu, rank, budget_bytes, chunk_bytes)) {
+      delete paged_U;
+      delete paged_V;
+      paged_U = paged_V = NULL;
+      return false;
+    }
+    U = paged_U->data;
+  }
+  else
+    U = new double[(long long)nu*rank];
+
+  n_users = nu;
+  n_items = ni;
+
+  is_allocated = true;
+  return true;
+}
+
+void Model::wrap(int nu, int ni, double *u, double *v) {
+  if (is_allocated) de_allocate();
+
+  U = u;
+  V = v;
+  n_users = nu;
+  n_items = ni;
+}
+
+// chunks read ahead and released by the working-set manager so far
+void Model::paging_stats(long long& n_prefetched, long long& n_released) const {
+  n_prefetched = n_released = 0;
+  if (paged_U != NULL) { n_prefetched += paged_U->n_prefetched; n_released += paged_U->n_released; }
+  if (paged_V != NULL) { n_prefetched += paged_V->n_prefetched; n_released += paged_V->n_released; }
+}
+
 void Model::de_allocate () {
 	if (!is_allocated) return;
   
-  delete [] this->U;
-	delete [] this->V;
+  if (paged_U != NULL) { delete paged_U; paged_U = NULL; }
+  else delete [] this->U;
+  if (paged_V != NULL) { delete paged_V; paged_V = NULL; }
+  else delete [] this->V;
 	this->U = NULL;
 	this->V = NULL;
 
@@ -61,16 +122,16 @@ void Model::de_allocate () {
 void Model::readFile(const std::string &file) {
   std::ifstream f;
   f.open(file, std::ios::in | std::ios::binary);
-  f.read(reinterpret_cast<char *>(U), n_users*rank*sizeof(double));
-  f.read(reinterpret_cast<char *>(V), n_items*rank*sizeof(double));
+  f.read(reinterpret_cast<char *>(U), (long long)n_users*rank*sizeof(double));
+  f.read(reinterpret_cast<char *>(V), (long long)n_items*rank*sizeof(double));
   f.close();
 }
 
 void Model::writeFile(const std::string &file) {
   std::ofstream f;
   f.open(file, std::ios::out | std::ios::binary);
-  f.write(reinterpret_cast<char *>(U), n_users*rank*sizeof(double));
-  f.write(reinterpret_cast<char *>(V), n_items*rank*sizeof(double));
+  f.write(reinterpret_cast<char *>(U), (long long)n_users*rank*sizeof(double));
+  f.write(reinterpret_cast<char *>(V), (long long)n_items*rank*sizeof(double));
   f.close();
 }
 
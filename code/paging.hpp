@@ -0,0 +1,134 @@
+#ifndef __PAGING_HPP__
+#define __PAGING_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// A row-major n_rows x rank matrix of doubles in a file-backed shared mapping, for factors
+// larger than memory. The OS pages rows in on access and can write cold pages back to the file;
+// on top of that, the rows are grouped in fixed-size chunks and a working set of at most
+// budget chunks is tracked in LRU order. prefetch() marks the chunks of the given rows as used,
+// asks the kernel to read the new ones ahead (MADV_WILLNEED) and releases the least recently
+// used chunks beyond the budget (written back, then MADV_DONTNEED).
+class PagedRows {
+  int fd;
+  size_t bytes;
+  int rank;
+  long long chunk_rows, n_chunks;
+  size_t budget;
+
+  std::list<long long> lru;                              // front : most recently used
+  std::vector<std::list<long long>::iterator> lru_pos;
+  std::vector<char> resident;
+  std::mutex m;
+
+  void release(long long);
+
+  public:
+    double *data;
+    long long n_prefetched, n_released;
+
+    PagedRows() : fd(-1), bytes(0), rank(0), chunk_rows(0), n_chunks(0), budget(0),
+                  data(NULL), n_prefetched(0), n_released(0) {}
+    ~PagedRows() { close(); }
+
+    bool open(const std::string&, long long, int, size_t, size_t);
+    void close();
+
+    void prefetch(const int*, int);
+};
+
+// map (and create or resize) file as n_rows x r doubles, with chunks of about chunk_bytes and a
+// working set of about budget_bytes
+bool PagedRows::open(const std::string& file, long long n_rows, int r, size_t budget_bytes, size_t chunk_bytes) {
+  close();
+
+  rank  = r;
+  bytes = sizeof(double) * n_rows * r;
+  if (bytes == 0) return false;
+
+  fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+  if (ftruncate(fd, bytes) != 0) { close(); return false; }
+
+  void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) { close(); return false; }
+  madvise(p, bytes, MADV_RANDOM);
+  data = (double*)p;
+
+  // chunks of whole pages : a multiple of page / gcd(page, row_bytes) rows
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t row_bytes = sizeof(double) * r;
+  size_t a = page, b = row_bytes;
+  while (b != 0) { size_t t = a % b; a = b; b = t; }
+  long long unit = page / a;
+  chunk_rows = std::max<long long>(chunk_bytes / row_bytes, 1);
+  chunk_rows = ((chunk_rows + unit - 1) / unit) * unit;
+  n_chunks = (n_rows + chunk_rows - 1) / chunk_rows;
+  budget   = std::max<size_t>(budget_bytes / (chunk_rows * row_bytes), 1);
+
+  lru.clear();
+  lru_pos.assign(n_chunks, lru.end());
+  resident.assign(n_chunks, 0);
+  n_prefetched = n_released = 0;
+
+  return true;
+}
+
+void PagedRows::close() {
+  if (data != NULL) {
+    msync(data, bytes, MS_SYNC);
+    munmap(data, bytes);
+  }
+  if (fd >= 0) ::close(fd);
+  data = NULL;
+  fd = -1;
+  bytes = 0;
+  lru.clear();
+  lru_pos.clear();
+  resident.clear();
+}
+
+void PagedRows::release(long long c) {
+  size_t offset = sizeof(double) * c * chunk_rows * rank;
+  size_t len = std::min<size_t>(sizeof(double) * chunk_rows * rank, bytes - offset);
+  msync((char*)data + offset, len, MS_ASYNC);
+  madvise((char*)data + offset, len, MADV_DONTNEED);
+  resident[c] = 0;
+  ++n_released;
+}
+
+void PagedRows::prefetch(const int *rows, int n) {
+  std::lock_guard<std::mutex> lock(m);
+
+  for(int i=0; i<n; ++i) {
+    long long c = rows[i] / chunk_rows;
+    if (resident[c]) {
+      lru.splice(lru.begin(), lru, lru_pos[c]);
+      continue;
+    }
+
+    size_t offset = sizeof(double) * c * chunk_rows * rank;
+    size_t len = std::min<size_t>(sizeof(double) * chunk_rows * rank, bytes - offset);
+    madvise((char*)data + offset, len, MADV_WILLNEED);
+    lru.push_front(c);
+    lru_pos[c] = lru.begin();
+    resident[c] = 1;
+    ++n_prefetched;
+  }
+
+  while (lru.size() > budget) {
+    release(lru.back());
+    lru.pop_back();
+  }
+}
+
+#endif
@@ -9,12 +9,17 @@
 #include <algorithm>
 #include <vector>
 #include <fstream>
+#include <random>
+#include <memory>
+#include <utility>
 
 #include "elements.hpp"
 #include "loss.hpp"
 
 using namespace std;
 
+class ImplicitFeedback;
+
 class Problem {
   public: 
     int n_users, n_items, n_train_comps; // number of users/items in training sample, number of samples in traing and testing data set
@@ -24,15 +29,31 @@ class Problem {
 
     vector<comparison>   train;
     vector<int>          tridx;
+    vector<double>       weight;          // importance weight of each comparison (empty if all ones)
+    vector<comparison>   validation;      // comparisons held out of train by split_validation
+
+    // load-time sampling budgets (0 : no limit)
+    int                  max_comps_per_user = 0;
+    int                  max_comps_per_pair = 0;
+    unsigned             sampling_seed = 1;
+
+    // implicit feedback : the positives behind train, whose item2 (negative) the solvers resample
+    const ImplicitFeedback *implicit = NULL;
 
     Problem();
     Problem(loss_option_t, double);				// default constructor
     ~Problem();					// default destructor
     void read_data(const std::string&);	// read function
+    void sort_user(int, int);
+    void write_data(const std::string&) const;
+    void split_validation(double, unsigned);
   
     int get_nusers() { return n_users; }
     int get_nitems() { return n_items; }
+    double get_weight(int i) const { return weight.empty() ? 1. : weight[i]; }
     double evaluate(Model& model);
+    double evaluate(Model& model, loss_option_t, double) const;
+    double validation_error(const Model&) const;
 };
 
 // may be more parameters can be specified here
@@ -45,33 +66,124 @@ Problem::Problem (loss_option_t option, double l) : lambda(l), loss_option(optio
 Problem::~Problem () {
 }
 
+// sort the comparisons [from, to) of a user, keeping the weights aligned
+void Problem::sort_user(int from, int to) {
+  if (weight.empty()) {
+    std::sort(train.begin()+from, train.begin()+to, comp_userwise);
+    return;
+  }
+
+  vector<pair<comparison,double> > block(to-from);
+  for(int i=from; i<to; ++i) block[i-from] = make_pair(train[i], weight[i]);
+  std::sort(block.begin(), block.end(), 
+            [](const pair<comparison,double>& a, const pair<comparison,double>& b) { return comp_userwise(a.first, b.first); });
+  for(int i=from; i<to; ++i) { train[i] = block[i-from].first; weight[i] = block[i-from].second; }
+}
+
+// Occurrence counts of item pairs in fixed memory (count-min sketch, depth x width counters with
+// conservative update). A count is never below the true one and exceeds it only through hash
+// collisions; the memory does not grow with the number of distinct pairs.
+class PairCounter {
+  static const int depth = 4, width = 1 << 20;
+  std::vector<unsigned> counts;
+
+  static unsigned long long mix(unsigned long long x) {
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+
+  public:
+    PairCounter() : counts((size_t)depth * width, 0) {}
+
+    // count the pair once more and return its estimated count so far
+    unsigned add(int i1, int i2) {
+      unsigned long long key = ((unsigned long long)(unsigned)i1 << 32) | (unsigned)i2;
+      unsigned *c[depth];
+      unsigned c_min = ~0u;
+      for(int d=0; d<depth; ++d) {
+        c[d] = &counts[(size_t)d * width + mix(key + (d + 1) * 0x9e3779b97f4a7c15ULL) % width];
+        c_min = std::min(c_min, *c[d]);
+      }
+      for(int d=0; d<depth; ++d) if (*c[d] == c_min) ++*c[d];
+      return c_min + 1;
+    }
+};
+
+// With max_comps_per_user, each user keeps a uniform reservoir sample of its comparisons,
+// weighted by (seen / kept). With max_comps_per_pair, a comparison of an item pair counted c times
+// so far (by PairCounter, which may overcount) is kept with probability min(1, max_comps_per_pair / c),
+// weighted by the inverse. Both keep the weighted loss an unbiased estimate of the loss over the
+// full file, and the memory of the sampling does not depend on the number of distinct pairs.
 void Problem::read_data(const std::string &train_file) {
 
   // Prepare to read files
   n_users = n_items = 0;
   ifstream f;
 
+  bool sampling = (max_comps_per_user > 0) || (max_comps_per_pair > 0);
+  std::mt19937 gen(sampling_seed);
+  std::uniform_real_distribution<double> unif(0., 1.);
+  std::unique_ptr<PairCounter> pair_count;
+  if (max_comps_per_pair > 0) pair_count.reset(new PairCounter);
+  long long n_seen_total = 0;
+
+  train.clear();
+  weight.clear();
+
   // Read training comparisons
   f.open(train_file);
   if (f.is_open()) {
     int uid, i1id, i2id, uid_current = 0;
+    long long n_seen = 0;                   // comparisons of the current user accepted by the pair sampling
     tridx.resize(0);
     tridx.push_back(0);
     while (f >> uid >> i1id >> i2id) {
       n_users = max(uid, n_users);
       n_items = max(i1id, max(i2id, n_items));
       --uid; --i1id; --i2id; // now user_id and item_id starts from 0
+      ++n_seen_total;
 
       while(uid > uid_current) {
-        std::sort(train.begin()+tridx[uid_current], train.end(), comp_userwise);
+        if ((max_comps_per_user > 0) && (n_seen > max_comps_per_user)) {
+          for(int i=tridx[uid_current]; i<train.size(); ++i) weight[i] *= (double)n_seen / (double)max_comps_per_user;
+        }
+        sort_user(tridx[uid_current], train.size());
         tridx.push_back(train.size());
         ++uid_current;
+        n_seen = 0;
+      }
+
+      double w = 1.;
+      if (max_comps_per_pair > 0) {
+        unsigned c = pair_count->add(i1id, i2id);
+        if (c > (unsigned)max_comps_per_pair) {
+          double p = (double)max_comps_per_pair / (double)c;
+          if (unif(gen) >= p) continue;
+          w = 1. / p;
+        }
+      }
+
+      ++n_seen;
+      if ((max_comps_per_user > 0) && (n_seen > max_comps_per_user)) {
+        // reservoir sampling : replace a random slot of the current user
+        long long j = (long long)(unif(gen) * (double)n_seen);
+        if (j < max_comps_per_user) {
+          train[tridx[uid_current]+j] = comparison(uid, i1id, i2id, 1);
+          weight[tridx[uid_current]+j] = w;
+        }
+        continue;
       }
 
       train.push_back(comparison(uid, i1id, i2id, 1));
+      if (sampling) weight.push_back(w);
     }
 
-    std::sort(train.begin()+tridx[uid_current], train.end(), comp_userwise);
+    if ((max_comps_per_user > 0) && (n_seen > max_comps_per_user)) {
+      for(int i=tridx[uid_current]; i<train.size(); ++i) weight[i] *= (double)n_seen / (double)max_comps_per_user;
+    }
+    sort_user(tridx[uid_current], train.size());
     tridx.push_back(train.size());
    
     n_train_comps = train.size();
@@ -83,11 +195,77 @@ void Problem::read_data(const std::string &train_file) {
   f.close();
 
   printf("%d users, %d items, %d comparisons\n", n_users, n_items, n_train_comps);
+  if (sampling) printf("%d of %lld comparisons sampled\n", n_train_comps, n_seen_total);
 
 }	
 
+// write comparisons in the format read by read_data
+void Problem::write_data(const std::string &train_file) const {
+  FILE *f = fopen(train_file.c_str(), "w");
+  if (f == NULL) {
+    printf("Error in opening the output file!\n");
+    exit(EXIT_FAILURE);
+  }
+  for(int i=0; i<train.size(); ++i)
+    fprintf(f, "%d %d %d\n", train[i].user_id+1, train[i].item1_id+1, train[i].item2_id+1);
+  fclose(f);
+}
+
+// Move a random fraction of the comparisons of every user to the validation set;
+// a user always keeps at least one training comparison.
+void Problem::split_validation(double frac, unsigned seed) {
+  vector<comparison> kept;
+  vector<double>     kept_weight;
+  vector<int>        kept_idx(1, 0);
+  validation.clear();
+
+  vector<int> perm;
+  for(int uid=0; uid<(int)tridx.size()-1; ++uid) {
+    int n = tridx[uid+1] - tridx[uid];
+    int n_val = min(n-1, (int)round(frac * n));
+
+    perm.resize(n);
+    for(int i=0; i<n; ++i) perm[i] = tridx[uid] + i;
+    std::mt19937 gen(seed + (unsigned)uid * 2654435761u);
+    std::shuffle(perm.begin(), perm.end(), gen);
+    if (n_val > 0) std::sort(perm.begin()+n_val, perm.end());
+
+    for(int i=0; i<n_val; ++i) validation.push_back(train[perm[i]]);
+    for(int i=max(n_val,0); i<n; ++i) {
+      kept.push_back(train[perm[i]]);
+      if (!weight.empty()) kept_weight.push_back(weight[perm[i]]);
+    }
+    kept_idx.push_back(kept.size());
+  }
+
+  train.swap(kept);
+  weight.swap(kept_weight);
+  tridx.swap(kept_idx);
+  n_train_comps = train.size();
+
+  printf("%d comparisons held out for validation\n", (int)validation.size());
+}
+
+// fraction of validation comparisons not strictly ordered by the model
+double Problem::validation_error(const Model& model) const {
+  long long n_err = 0;
+  #pragma omp parallel for reduction(+:n_err)
+  for(int i=0; i<validation.size(); ++i) {
+    const comparison& c = validation[i];
+    double s = 0.;
+    for(int k=0; k<model.rank; ++k) s += model.U[(long long)c.user_id*model.rank+k] * (model.V[(long long)c.item1_id*model.rank+k] - model.V[(long long)c.item2_id*model.rank+k]);
+    if (!(s > 0.)) ++n_err;
+  }
+  return validation.empty() ? 0. : (double)n_err / (double)validation.size();
+}
+
 double Problem::evaluate(Model& model) {
-  double l = compute_loss(model, train, loss_option);
+  return evaluate(model, loss_option, lambda);
+}
+
+// objective value under a loss and regularization other than the problem's own
+double Problem::evaluate(Model& model, loss_option_t loss_option, double lambda) const {
+  double l = compute_loss(model, train, loss_option, weight.empty() ? NULL : weight.data());
   double u = model.Unormsq();
   double v = model.Vnormsq();
  
@@ -98,5 +276,31 @@ double Problem::evaluate(Model& model) {
   return f;
 }
 
+// comparisons by item (both sides, item1 == item2 left out) for the item-wise gathers (V-steps, SVD initialization)
+class ItemComparisons {
+  public:
+    std::vector<long long> ptr;
+    std::vector<int>       comps;
+
+    void build(const Problem&);
+};
+
+void ItemComparisons::build(const Problem& prob) {
+  ptr.assign(prob.n_items+1, 0);
+  for(int i=0; i<prob.n_train_comps; ++i) {
+    if (prob.train[i].item1_id == prob.train[i].item2_id) continue;
+    ++ptr[prob.train[i].item1_id+1];
+    ++ptr[prob.train[i].item2_id+1];
+  }
+  for(int iid=0; iid<prob.n_items; ++iid) ptr[iid+1] += ptr[iid];
+
+  comps.resize(ptr[prob.n_items]);
+  std::vector<long long> pos(ptr.begin(), ptr.end()-1);
+  for(int i=0; i<prob.n_train_comps; ++i) {
+    if (prob.train[i].item1_id == prob.train[i].item2_id) continue;
+    comps[pos[prob.train[i].item1_id]++] = i;
+    comps[pos[prob.train[i].item2_id]++] = i;
+  }
+}
 
 #endif
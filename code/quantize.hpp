@@ -0,0 +1,204 @@
+#ifndef __QUANTIZE_HPP__
+#define __QUANTIZE_HPP__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+
+#include "model.hpp"
+#include "scoring.hpp"
+
+enum quant_option_t {QUANT_INT8, QUANT_BF16};
+
+// Low-precision copy of a factor matrix (n_rows x rank), for serving and top-K scans.
+//   int8 : every row is scaled by max|x| / 127 and rounded, x ~= scale * q
+//   bf16 : the upper 16 bits of the float (round to nearest even), scale 1
+class QuantizedFactors {
+  public:
+    quant_option_t option;
+    int n_rows, rank;
+    std::vector<float>    scale;
+    std::vector<int8_t>   q8;
+    std::vector<uint16_t> q16;
+
+    QuantizedFactors() : option(QUANT_INT8), n_rows(0), rank(0) {}
+
+    void quantize(const double*, int, int, quant_option_t);
+    double dot(int, const QuantizedFactors&, int) const;
+    size_t bytes() const { return scale.size() * sizeof(float) + q8.size() + q16.size() * sizeof(uint16_t); }
+
+    void write(FILE*) const;
+};
+
+inline uint16_t float_to_bf16(float x) {
+  uint32_t b;
+  memcpy(&b, &x, sizeof(b));
+  b += 0x7FFFu + ((b >> 16) & 1u);
+  return (uint16_t)(b >> 16);
+}
+
+inline float bf16_to_float(uint16_t h) {
+  uint32_t b = (uint32_t)h << 16;
+  float x;
+  memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+bool parse_quant(const std::string& name, quant_option_t& option) {
+  if (name == "int8")
+    option = QUANT_INT8;
+  else if (name == "bf16")
+    option = QUANT_BF16;
+  else
+    return false;
+  return true;
+}
+
+const char* quant_name(quant_option_t option) { return (option == QUANT_INT8) ? "int8" : "bf16"; }
+
+void QuantizedFactors::quantize(const double *X, int n, int r, quant_option_t opt) {
+  option = opt;
+  n_rows = n;
+  rank   = r;
+  scale.assign(n, 1.f);
+  q8.clear();
+  q16.clear();
+  if (option == QUANT_INT8) q8.resize((size_t)n * r); else q16.resize((size_t)n * r);
+
+  #pragma omp parallel for
+  for(int i=0; i<n; ++i) {
+    const double *x = &X[(size_t)i * r];
+    if (option == QUANT_INT8) {
+      double m = 0.;
+      for(int k=0; k<r; ++k) m = std::max(m, fabs(x[k]));
+      scale[i] = (m > 0.) ? (float)(m / 127.) : 1.f;
+      for(int k=0; k<r; ++k) q8[(size_t)i * r + k] = (int8_t)lrint(x[k] / scale[i]);
+    }
+    else {
+      for(int k=0; k<r; ++k) q16[(size_t)i * r + k] = float_to_bf16((float)x[k]);
+    }
+  }
+}
+
+// approximate inner product of row i with row j of another quantization of the same scheme;
+// int8 rows are multiplied in integers and rescaled once
+inline double QuantizedFactors::dot(int i, const QuantizedFactors& other, int j) const {
+  if (option == QUANT_INT8) {
+    const int8_t *a = &q8[(size_t)i * rank], *b = &other.q8[(size_t)j * rank];
+    int32_t s = 0;
+    for(int k=0; k<rank; ++k) s += (int32_t)a[k] * (int32_t)b[k];
+    return (double)scale[i] * (double)other.scale[j] * (double)s;
+  }
+  else {
+    const uint16_t *a = &q16[(size_t)i * rank], *b = &other.q16[(size_t)j * rank];
+    float s = 0.f;
+    for(int k=0; k<rank; ++k) s += bf16_to_float(a[k]) * bf16_to_float(b[k]);
+    return (double)s;
+  }
+}
+
+// header (scheme, n_rows, rank as int), the scales (float, n_rows) and the codes (int8 or bf16, n_rows x rank)
+void QuantizedFactors::write(FILE *f) const {
+  int header[3] = { (int)option, n_rows, rank };
+  fwrite(header, sizeof(int), 3, f);
+  fwrite(scale.data(), sizeof(float), scale.size(), f);
+  if (option == QUANT_INT8) fwrite(q8.data(), sizeof(int8_t), q8.size(), f);
+  else fwrite(q16.data(), sizeof(uint16_t), q16.size(), f);
+}
+
+// prefix.<scheme> : quantized U followed by quantized V
+bool write_quantized(const std::string& file, const QuantizedFactors& QU, const QuantizedFactors& QV) {
+  FILE *f = fopen(file.c_str(), "wb");
+  if (f == NULL) return false;
+  QU.write(f);
+  QV.write(f);
+  fclose(f);
+  return true;
+}
+
+// the K best items of a user by exact scores, best first
+void topk_exact(const Model& model, int uid, int K, std::vector<std::pair<double, int> >& buf, std::vector<int>& top) {
+  const double *u = &model.U[(size_t)uid * model.rank];
+  buf.resize(model.n_items);
+  for(int j=0; j<model.n_items; ++j) {
+    const double *v = &model.V[(size_t)j * model.rank];
+    double s = 0.;
+    for(int k=0; k<model.rank; ++k) s += u[k] * v[k];
+    buf[j] = std::make_pair(s, j);
+  }
+
+  K = std::min(K, model.n_items);
+  std::partial_sort(buf.begin(), buf.begin()+K, buf.end(), score_greater);
+  top.resize(K);
+  for(int j=0; j<K; ++j) top[j] = buf[j].second;
+}
+
+// the K best items of a user : the shortlist best by quantized scores, reranked by exact scores
+void topk_quantized(const Model& model, const QuantizedFactors& QU, const QuantizedFactors& QV, int uid, int K, int shortlist,
+                    std::vector<std::pair<double, int> >& buf, std::vector<int>& top) {
+  buf.resize(model.n_items);
+  for(int j=0; j<model.n_items; ++j) buf[j] = std::make_pair(QU.dot(uid, QV, j), j);
+
+  shortlist = std::min(std::max(shortlist, K), model.n_items);
+  std::nth_element(buf.begin(), buf.begin()+shortlist-1, buf.end(), score_greater);
+
+  const double *u = &model.U[(size_t)uid * model.rank];
+  for(int c=0; c<shortlist; ++c) {
+    const double *v = &model.V[(size_t)buf[c].second * model.rank];
+    double s = 0.;
+    for(int k=0; k<model.rank; ++k) s += u[k] * v[k];
+    buf[c].first = s;
+  }
+
+  K = std::min(K, shortlist);
+  std::partial_sort(buf.begin(), buf.begin()+K, buf.begin()+shortlist, score_greater);
+  top.resize(K);
+  for(int j=0; j<K; ++j) top[j] = buf[j].second;
+}
+
+// recall@K of the quantized top-K against the exact one, averaged over the users; the
+// time of the two scans is returned in time_exact / time_quant (seconds)
+double quantized_recall(const Model& model, const QuantizedFactors& QU, const QuantizedFactors& QV, int K, int shortlist,
+                        const std::vector<int>& users, double& time_exact, double& time_quant) {
+  int n = users.size();
+  std::vector<std::vector<int> > exact(n);
+
+  time_exact = omp_get_wtime();
+  #pragma omp parallel
+  {
+    std::vector<std::pair<double, int> > buf;
+    #pragma omp for
+    for(int i=0; i<n; ++i) topk_exact(model, users[i], K, buf, exact[i]);
+  }
+  time_exact = omp_get_wtime() - time_exact;
+
+  double recall = 0.;
+  time_quant = omp_get_wtime();
+  #pragma omp parallel reduction(+:recall)
+  {
+    std::vector<std::pair<double, int> > buf;
+    std::vector<int> top;
+    #pragma omp for
+    for(int i=0; i<n; ++i) {
+      topk_quantized(model, QU, QV, users[i], K, shortlist, buf, top);
+      std::vector<int> a(exact[i]), b(top);
+      std::sort(a.begin(), a.end());
+      std::sort(b.begin(), b.end());
+      std::vector<int> common;
+      std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(common));
+      if (!a.empty()) recall += (double)common.size() / (double)a.size();
+    }
+  }
+  time_quant = omp_get_wtime() - time_quant;
+
+  return (n > 0) ? recall / (double)n : 0.;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __RANDOM_HPP__
+#define __RANDOM_HPP__
+
+#include <stdint.h>
+#include <math.h>
+
+// Philox4x32-10 counter-based generator (Salmon et al., SC'11).
+// The output is a pure function of (key, counter), so row r of a matrix can be filled from
+// counter (r, block, stream) by any thread, and the result does not depend on the number of threads.
+inline void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+  uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+  uint32_t k0 = key[0], k1 = key[1];
+
+  for(int r=0; r<10; ++r) {
+    uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+    uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+    uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += 0x9E3779B9u;
+    k1 += 0xBB67AE85u;
+  }
+
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// n uniforms in (0, 1) for the given row of a stream
+inline void philox_uniform(uint64_t seed, uint32_t stream, uint64_t row, double *x, int n) {
+  uint32_t key[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+  uint32_t ctr[4] = { (uint32_t)row, (uint32_t)(row >> 32), 0, stream };
+  uint32_t out[4];
+
+  for(int i=0; i<n; i+=4) {
+    ctr[2] = i / 4;
+    philox4x32(ctr, key, out);
+    for(int j=0; (j<4) && (i+j<n); ++j) x[i+j] = ((double)out[j] + .5) / 4294967296.;
+  }
+}
+
+// n standard normals for the given row of a stream (Box-Muller)
+inline void philox_normal(uint64_t seed, uint32_t stream, uint64_t row, double *x, int n) {
+  philox_uniform(seed, stream, row, x, n);
+  for(int i=0; i+1<n; i+=2) {
+    double r = sqrt(-2. * log(x[i])), t = 2. * M_PI * x[i+1];
+    x[i]   = r * cos(t);
+    x[i+1] = r * sin(t);
+  }
+  if (n % 2 == 1) {
+    double u;
+    philox_uniform(seed, stream ^ 0x80000000u, row, &u, 1);
+    x[n-1] = sqrt(-2. * log(x[n-1])) * cos(2. * M_PI * u);
+  }
+}
+
+#endif
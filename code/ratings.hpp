@@ -5,7 +5,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <omp.h>
 #include <algorithm>
+#include <functional>
 #include <vector>
 #include <iostream>
 #include <fstream>
@@ -13,6 +15,7 @@
 
 #include "elements.hpp"
 #include "model.hpp"
+#include "mmapfile.hpp"
 
 class RatingMatrix {
   public:
@@ -20,17 +23,23 @@ class RatingMatrix {
     std::vector<rating>   ratings;
     std::vector<int>      idx;
 
-    int                   ndcg_k = 0;
+    int                   ndcg_k = 0;                 // largest cutoff
+    std::vector<int>      ndcg_cutoffs;               // in increasing order
     bool                  is_dcg_max_computed = false;
-    std::vector<double>   dcg_max;
+    std::vector<double>   dcg_max;                    // n_users x ndcg_cutoffs.size()
+    std::vector<double>   gain;                       // 2^score - 1 of each rating
+    std::vector<double>   discount;                   // discount[k-1] = 1 / log2(k+1)
     
     void compute_dcgmax(int);
+    void compute_dcgmax(const std::vector<int>&);
     double compute_user_ndcg(int, const std::vector<double>&) const;
+    void compute_user_ndcg(int, const std::vector<double>&, std::vector<int>&, double*) const;
 
     RatingMatrix() : n_users(0), n_items(0) {}
     RatingMatrix(int nu, int ni): n_users(nu), n_items(ni) {}
 
     void read_lsvm(const std::string&);
+    void write_lsvm(const std::string&) const;
     void read_spformat(const std::string&);
 };
 
@@ -40,31 +49,35 @@ std::ifstream::pos_type filesize(const char* filename)
     return in.tellg(); 
 }
 
-double RatingMatrix::compute_user_ndcg(int uid, const std::vector<double>& score) const {
-  std::vector<std::pair<double,int> > ranking;
-  for(int j=0; j<score.size(); ++j) ranking.push_back(std::pair<double,int>(score[j],0));
+// NDCG of a user at every cutoff (written to ndcg) from one partial sort of its scores.
+// score[j] is the predicted score of rating idx[uid]+j; ties go to the earlier rating.
+void RatingMatrix::compute_user_ndcg(int uid, const std::vector<double>& score, std::vector<int>& order, double *ndcg) const {
+  int n = score.size();
+  int k_max = std::min(ndcg_k, n);
 
-  double min_score = ranking[0].first;
-  for(int j=0; j<ranking.size(); ++j) min_score = std::min(min_score, ranking[j].first);
+  order.resize(n);
+  for(int j=0; j<n; ++j) order[j] = j;
+  std::partial_sort(order.begin(), order.begin()+k_max, order.end(), 
+                    [&score](int a, int b) { return (score[a] > score[b]) || ((score[a] == score[b]) && (a < b)); });
 
+  const double *g = &gain[idx[uid]];
   double dcg = 0.;
-  for(int k=1; k<=ndcg_k; ++k) {
-    int topk_idx = -1;
-    double max_score = min_score - 1.;
-    for(int j=0; j<ranking.size(); ++j) {
-      if ((ranking[j].second == 0) && (ranking[j].first > max_score)) {
-        max_score = ranking[j].first;
-        topk_idx = j;
-      }
-    }
-    ranking[topk_idx].second = k;
-     
-    dcg += (double)(pow(2,ratings[idx[uid]+topk_idx].score) - 1) / log2((double)(k+1));
+  for(int c=0, k=0; c<ndcg_cutoffs.size(); ++c) {
+    for(; k<std::min(ndcg_cutoffs[c], n); ++k) dcg += g[order[k]] * discount[k];
+    ndcg[c] = dcg / dcg_max[uid*ndcg_cutoffs.size()+c];
   }
+}
 
-  return dcg / dcg_max[uid];
+// NDCG of a user at the largest cutoff
+double RatingMatrix::compute_user_ndcg(int uid, const std::vector<double>& score) const {
+  std::vector<int> order;
+  std::vector<double> ndcg(ndcg_cutoffs.size());
+  compute_user_ndcg(uid, score, order, ndcg.data());
+  return ndcg.back();
 } 
 
+// One line per user with "item:score" pairs (1-based item ids); reading stops at the first empty line.
+// The file is memory-mapped and parsed in parallel over line-aligned chunks.
 void RatingMatrix::read_lsvm(const std::string& filename) {
   
   ratings.clear();
@@ -73,86 +86,197 @@ void RatingMatrix::read_lsvm(const std::string& filename) {
   n_users = 0;
   n_items = 0;
 
-  // Read ratings file for NDCG
-  std::vector<rating> ratings_current_user(0);
-  std::string user_str, attribute_str;
-  std::stringstream attribute_sstr;  
-
-  std::ifstream f;
- 
-  f.open(filename);
-  if (f.is_open()) {
-    int    uid = 0, iid;
-    double sc;
-    idx.push_back(0);
-      
-    while(1) {
-      getline(f, user_str);
-
-      size_t pos1 = 0, pos2;
-      while(1) {
-        pos2 = user_str.find(':', pos1); if (pos2 == std::string::npos) break; 
-        attribute_str = user_str.substr(pos1, pos2-pos1);
-        attribute_sstr.clear(); attribute_sstr.str(attribute_str);
-        attribute_sstr >> iid;
-        n_items = std::max(n_items, iid);
-        --iid;
-        pos1 = pos2+1;
-
-        pos2 = user_str.find(' ', pos1); attribute_str = user_str.substr(pos1, pos2-pos1);
-        attribute_sstr.clear(); attribute_sstr.str(attribute_str);
-        attribute_sstr >> sc;
-        pos1 = pos2+1;
-
-        ratings_current_user.push_back(rating(uid, iid, sc));
+  MappedFile f;
+  if (!f.open(filename)) {
+    printf("Error in opening the extracted rating file!\n");
+    std::cout << filename << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  int n_chunks = omp_get_max_threads();
+  std::vector<size_t> bound = f.line_chunks(n_chunks);
+
+  // ratings and line lengths of each chunk
+  std::vector<std::vector<rating> > chunk_ratings(n_chunks);
+  std::vector<std::vector<int> >    chunk_lines(n_chunks);
+  int max_item = 0;
+
+  #pragma omp parallel for schedule(static,1) reduction(max:max_item)
+  for(int c=0; c<n_chunks; ++c) {
+    const char *p = f.data + bound[c], *end = f.data + bound[c+1];
+    std::vector<rating>& r = chunk_ratings[c];
+    std::vector<int>& lines = chunk_lines[c];
+
+    while (p < end) {
+      int n = 0, iid;
+      double sc;
+      while ((p < end) && (*p != '\n')) {
+        const char *q = parse_int(p, end, iid);
+        if ((q == p) || (q >= end) || (*q != ':')) { p = (q == p) ? p+1 : q; continue; }
+        p = parse_double(q+1, end, sc);
+        if (p == q+1) continue;
+
+        max_item = std::max(max_item, iid);
+        r.push_back(rating(0, iid-1, sc));
+        ++n;
       }
-      if (ratings_current_user.size() == 0) break;
-         
-      sort(ratings_current_user.begin(), ratings_current_user.end(), rating_userwise);
- 
-      for(int j=0; j<ratings_current_user.size(); ++j) ratings.push_back(ratings_current_user[j]);
-      idx.push_back(ratings.size());
-    
-      ratings_current_user.clear();
- 
-      ++uid;
+      lines.push_back(n);
+      ++p;
     }
+  }
 
-    n_users = uid;
+  // users are the lines before the first empty one
+  for(int c=0; c<n_chunks; ++c) {
+    int l = 0;
+    while ((l < chunk_lines[c].size()) && (chunk_lines[c][l] > 0)) ++l;
+    n_users += l;
+    if (l < chunk_lines[c].size()) break;
+  }
 
-    printf("%d users, %d items \n", n_users, n_items);
+  idx.resize(n_users+1);
+  idx[0] = 0;
+  std::vector<int> chunk_uid(n_chunks+1, 0), chunk_offset(n_chunks+1, 0);
+  for(int c=0, uid=0; c<n_chunks; ++c) {
+    chunk_uid[c] = uid;
+    chunk_offset[c] = idx[uid];
+    for(int l=0; (l < chunk_lines[c].size()) && (uid < n_users); ++l, ++uid) idx[uid+1] = idx[uid] + chunk_lines[c][l];
+  }
+  ratings.resize(idx[n_users]);
 
-  } else {
-      printf("Error in opening the extracted rating file!\n");
-      std::cout << filename << std::endl;
-      exit(EXIT_FAILURE);
+  #pragma omp parallel for schedule(static,1)
+  for(int c=0; c<n_chunks; ++c) {
+    int uid = chunk_uid[c];
+    for(int l=0, i=0; (l < chunk_lines[c].size()) && (uid < n_users); ++l, ++uid) {
+      for(int j=0; j<chunk_lines[c][l]; ++j, ++i) {
+        rating& r = ratings[idx[uid]+j];
+        r = chunk_ratings[c][i];
+        r.user_id = uid;
+      }
+      if (!std::is_sorted(ratings.begin()+idx[uid], ratings.begin()+idx[uid+1], rating_userwise))
+        std::sort(ratings.begin()+idx[uid], ratings.begin()+idx[uid+1], rating_userwise);
+    }
+    std::vector<rating>().swap(chunk_ratings[c]);
   }
-  
-  f.close();
+
+  // only items of the kept users count
+  n_items = 0;
+  #pragma omp parallel for reduction(max:n_items)
+  for(int i=0; i<ratings.size(); ++i) n_items = std::max(n_items, ratings[i].item_id+1);
+
+  printf("%d users, %d items \n", n_users, n_items);
+}
+
+// one line per user, "item:score " pairs with 1-based item ids
+void RatingMatrix::write_lsvm(const std::string& filename) const {
+  FILE *f = fopen(filename.c_str(), "w");
+  if (f == NULL) {
+    printf("Error in opening the output file!\n");
+    exit(EXIT_FAILURE);
+  }
+  for(int uid=0; uid<n_users; ++uid) {
+    for(int i=idx[uid]; i<idx[uid+1]; ++i) fprintf(f, "%d:%g ", ratings[i].item_id+1, ratings[i].score);
+    fprintf(f, "\n");
+  }
+  fclose(f);
 }
 
 void RatingMatrix::compute_dcgmax(int ndcgK) {
+  compute_dcgmax(std::vector<int>(1, ndcgK));
+}
 
-  ndcg_k = ndcgK;
+void RatingMatrix::compute_dcgmax(const std::vector<int>& cutoffs) {
 
-  std::vector<rating> ratings_current_user(0);
+  ndcg_cutoffs = cutoffs;
+  std::sort(ndcg_cutoffs.begin(), ndcg_cutoffs.end());
+  ndcg_k = ndcg_cutoffs.back();
 
-  dcg_max.resize(n_users, 0.);  
-  for(int uid=0; uid<n_users; ++uid) {
-    for(int i=idx[uid]; i<idx[uid+1]; ++i) ratings_current_user.push_back(ratings[i]);
-    
-    std::sort(ratings_current_user.begin(), ratings_current_user.end(), rating_scorewise);
-    
-    for(int k=1; k<=ndcg_k; ++k) dcg_max[uid] += (double)(pow(2,ratings_current_user[k-1].score) - 1.) / log2(k+1); 
-    
-    ratings_current_user.clear();
+  discount.resize(ndcg_k);
+  for(int k=1; k<=ndcg_k; ++k) discount[k-1] = 1. / log2((double)(k+1));
+
+  gain.resize(ratings.size());
+  #pragma omp parallel for
+  for(int i=0; i<ratings.size(); ++i) gain[i] = pow(2., ratings[i].score) - 1.;
+
+  int n_cutoffs = ndcg_cutoffs.size();
+  dcg_max.assign(n_users * n_cutoffs, 0.);  
+
+  #pragma omp parallel
+  {
+    std::vector<double> g;
+
+    #pragma omp for schedule(dynamic,64)
+    for(int uid=0; uid<n_users; ++uid) {
+      g.assign(gain.begin()+idx[uid], gain.begin()+idx[uid+1]);
+      int k_max = std::min(ndcg_k, (int)g.size());
+      std::partial_sort(g.begin(), g.begin()+k_max, g.end(), std::greater<double>());
+
+      double dcg = 0.;
+      for(int c=0, k=0; c<n_cutoffs; ++c) {
+        for(; k<std::min(ndcg_cutoffs[c], (int)g.size()); ++k) dcg += g[k] * discount[k];
+        dcg_max[uid*n_cutoffs+c] = dcg;
+      }
+    }
   }
 
   is_dcg_max_computed = true; 
 }
 
+// Coordinate format : one "user item score" line per rating (1-based ids), in any order.
+// Parsed in parallel over line-aligned chunks of the memory-mapped file, then grouped by user.
 void RatingMatrix::read_spformat(const std::string& filename) {
-  // read sparse matrix format
+
+  ratings.clear();
+  idx.clear();
+
+  MappedFile f;
+  if (!f.open(filename)) {
+    printf("Error in opening the rating file!\n");
+    std::cout << filename << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  int n_chunks = omp_get_max_threads();
+  std::vector<size_t> bound = f.line_chunks(n_chunks);
+  std::vector<std::vector<rating> > chunk_ratings(n_chunks);
+  int max_user = 0, max_item = 0;
+
+  #pragma omp parallel for schedule(static,1) reduction(max:max_user,max_item)
+  for(int c=0; c<n_chunks; ++c) {
+    const char *p = f.data + bound[c], *end = f.data + bound[c+1];
+    while (p < end) {
+      int uid, iid;
+      double sc;
+      const char *q = parse_int(p, end, uid), *r;
+      if ((q != p) && ((r = parse_int(q, end, iid)) != q) && ((q = parse_double(r, end, sc)) != r)) {
+        chunk_ratings[c].push_back(rating(uid-1, iid-1, sc));
+        max_user = std::max(max_user, uid);
+        max_item = std::max(max_item, iid);
+      }
+      while ((q < end) && (*q != '\n')) ++q;
+      p = q+1;
+    }
+  }
+
+  n_users = max_user;
+  n_items = max_item;
+
+  // group by user
+  idx.assign(n_users+1, 0);
+  for(int c=0; c<n_chunks; ++c)
+    for(int i=0; i<chunk_ratings[c].size(); ++i) ++idx[chunk_ratings[c][i].user_id+1];
+  for(int uid=0; uid<n_users; ++uid) idx[uid+1] += idx[uid];
+
+  ratings.resize(idx[n_users]);
+  std::vector<int> pos(idx.begin(), idx.end()-1);
+  for(int c=0; c<n_chunks; ++c) {
+    for(int i=0; i<chunk_ratings[c].size(); ++i) ratings[pos[chunk_ratings[c][i].user_id]++] = chunk_ratings[c][i];
+    std::vector<rating>().swap(chunk_ratings[c]);
+  }
+
+  #pragma omp parallel for schedule(dynamic,64)
+  for(int uid=0; uid<n_users; ++uid) std::sort(ratings.begin()+idx[uid], ratings.begin()+idx[uid+1], rating_userwise);
+
+  printf("%d users, %d items \n", n_users, n_items);
 }
 
 #endif
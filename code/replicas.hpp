@@ -0,0 +1,108 @@
+#ifndef __REPLICAS_HPP__
+#define __REPLICAS_HPP__
+
+#include <omp.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+enum merge_option_t {MERGE_SUM, MERGE_AVERAGE};
+
+// Per-thread private copies of the item rows that appear in the most comparisons.
+// A thread updates its own replica of a hot row instead of the shared row, so that the
+// head items are not bounced between cores on every update; tail items stay shared.
+// sync() adds the change of a replica since the last sync to the shared row (MERGE_SUM),
+// or 1/n_threads of it (MERGE_AVERAGE, i.e. the shared row moves to the mean of the replicas),
+// and refreshes the replica. Hot shared rows are only written by sync().
+class HotItemReplicas {
+  int n_threads, rank;
+  merge_option_t merge_option;
+
+  std::vector<int> slot;                          // item -> hot index, -1 for tail items
+  std::vector<int> items;                         // hot index -> item
+  std::vector<std::vector<double> > replica;      // per thread, n_hot x rank
+  std::vector<std::vector<double> > base;         // per thread, shared rows at the last sync
+  std::vector<std::vector<double> > scale;        // per thread, row scales (SolverSGD)
+
+  public:
+    HotItemReplicas() : n_threads(0), rank(0), merge_option(MERGE_SUM) {}
+
+    bool enabled() const { return !items.empty(); }
+    int size() const { return items.size(); }
+
+    void select(const std::vector<int>&, int, int, int, merge_option_t);
+    void clear();
+
+    bool is_hot(int iid) const { return !items.empty() && (slot[iid] >= 0); }
+    double* row(int i_thread, int iid, double *V, int r) {
+      return is_hot(iid) ? &replica[i_thread][slot[iid] * r] : &V[(long long)iid * r];
+    }
+    double* row_scale(int i_thread, int iid, double *scale_V) {
+      return is_hot(iid) ? &scale[i_thread][slot[iid]] : &scale_V[iid];
+    }
+
+    void pull(int, const double*);
+    void push(int, double*);
+    void sync(int i_thread, double *V) { push(i_thread, V); pull(i_thread, V); }
+};
+
+// hot items : the n_hot items with the largest comparison counts
+void HotItemReplicas::select(const std::vector<int>& n_comps_by_item, int n_hot, int n_th, int r, merge_option_t option) {
+  clear();
+  n_hot = std::min(n_hot, (int)n_comps_by_item.size());
+  if ((n_hot <= 0) || (n_th <= 1)) return;
+
+  n_threads    = n_th;
+  rank         = r;
+  merge_option = option;
+
+  std::vector<int> order(n_comps_by_item.size());
+  for(int i=0; i<order.size(); ++i) order[i] = i;
+  std::partial_sort(order.begin(), order.begin()+n_hot, order.end(),
+                    [&n_comps_by_item](int a, int b) { return n_comps_by_item[a] > n_comps_by_item[b]; });
+
+  slot.assign(n_comps_by_item.size(), -1);
+  items.assign(order.begin(), order.begin()+n_hot);
+  for(int h=0; h<n_hot; ++h) slot[items[h]] = h;
+
+  replica.assign(n_threads, std::vector<double>(n_hot * rank));
+  base.assign(n_threads, std::vector<double>(n_hot * rank));
+  scale.assign(n_threads, std::vector<double>(n_hot, 1.));
+}
+
+void HotItemReplicas::clear() {
+  slot.clear();
+  items.clear();
+  replica.clear();
+  base.clear();
+  scale.clear();
+}
+
+// refresh the replicas of a thread from the shared rows
+void HotItemReplicas::pull(int i_thread, const double *V) {
+  if (!enabled()) return;
+  for(int h=0; h<items.size(); ++h) {
+    memcpy(&replica[i_thread][h * rank], &V[(long long)items[h] * rank], sizeof(double) * rank);
+    scale[i_thread][h] = 1.;
+  }
+  base[i_thread] = replica[i_thread];
+}
+
+// merge the changes of the replicas of a thread into the shared rows
+void HotItemReplicas::push(int i_thread, double *V) {
+  if (!enabled()) return;
+  double factor = (merge_option == MERGE_AVERAGE) ? 1. / (double)n_threads : 1.;
+
+  for(int h=0; h<items.size(); ++h) {
+    const double *r = &replica[i_thread][h * rank], *b = &base[i_thread][h * rank];
+    double s = scale[i_thread][h];
+    double *v = &V[(long long)items[h] * rank];
+    for(int k=0; k<rank; ++k) {
+      double d = factor * (s * r[k] - b[k]);
+      #pragma omp atomic
+      v[k] += d;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef __SCORING_HPP__
+#define __SCORING_HPP__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <omp.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include "model.hpp"
+#include "mmapfile.hpp"
+
+// orders (score, item) by decreasing score, then increasing item
+inline bool score_greater(const std::pair<double, int>& a, const std::pair<double, int>& b) {
+  return (a.first > b.first) || ((a.first == b.first) && (a.second < b.second));
+}
+
+// items already seen by every user ("user item" lines, 1-based), sorted per user in CSR form
+class SeenItems {
+  public:
+    std::vector<long long> ptr;
+    std::vector<int>       items;
+
+    int n_users() const { return ptr.size() - 1; }
+    bool read(const std::string&, int);
+};
+
+bool SeenItems::read(const std::string& filename, int n_users) {
+  MappedFile f;
+  if (!f.open(filename)) return false;
+
+  std::vector<std::pair<int, int> > pairs;
+  const char *p = f.data, *end = f.data + f.size;
+  while (p < end) {
+    int uid, iid;
+    const char *q = parse_int(p, end, uid);
+    const char *r = (q != p) ? parse_int(q, end, iid) : q;
+    if ((r != q) && (uid >= 1) && (uid <= n_users) && (iid >= 1)) pairs.push_back(std::make_pair(uid-1, iid-1));
+    while ((r < end) && (*r != '\n')) ++r;
+    p = r + 1;
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  ptr.assign(n_users+1, 0);
+  items.resize(pairs.size());
+  for(long long i=0; i<pairs.size(); ++i) {
+    ++ptr[pairs[i].first+1];
+    items[i] = pairs[i].second;
+  }
+  for(int uid=0; uid<n_users; ++uid) ptr[uid+1] += ptr[uid];
+
+  return true;
+}
+
+// Top-K of a block of users by exact scores, excluding seen items. Items are scored in tiles
+// of item_tile rows of V; the block x tile scores are one small matrix product, so that a tile
+// is read from memory once for the whole block. Items in the CSR lists seen_ptr / seen_items
+// (as in SeenItems; NULL : none) are skipped. heaps[b] ends up holding the K best items of
+// users[b], best first (empty for K <= 0).
+void topk_block(const Model& model, const int *users, int n_block, int K, const long long *seen_ptr, const int *seen_items,
+                int item_tile, std::vector<double>& scores, std::vector<std::vector<std::pair<double, int> > >& heaps) {
+  int rank = model.rank;
+  K = std::min(K, model.n_items);
+  scores.resize((size_t)n_block * item_tile);
+  heaps.resize(n_block);
+  for(int b=0; b<n_block; ++b) heaps[b].clear();
+  if (K <= 0) return;
+
+  std::vector<long long> next_seen(n_block);
+  for(int b=0; b<n_block; ++b) next_seen[b] = (seen_ptr != NULL) ? seen_ptr[users[b]] : 0;
+
+  for(int j0=0; j0<model.n_items; j0+=item_tile) {
+    int n_tile = std::min(item_tile, model.n_items - j0);
+
+    for(int b=0; b<n_block; ++b) {
+      const double *u = &model.U[(size_t)users[b] * rank];
+      double *s = &scores[(size_t)b * item_tile];
+      for(int j=0; j<n_tile; ++j) {
+        const double *v = &model.V[(size_t)(j0+j) * rank];
+        double prod = 0.;
+        for(int k=0; k<rank; ++k) prod += u[k] * v[k];
+        s[j] = prod;
+      }
+    }
+
+    for(int b=0; b<n_block; ++b) {
+      const double *s = &scores[(size_t)b * item_tile];
+      std::vector<std::pair<double, int> >& heap = heaps[b];
+      long long seen_end = (seen_ptr != NULL) ? seen_ptr[users[b]+1] : 0;
+
+      for(int j=0; j<n_tile; ++j) {
+        int iid = j0 + j;
+        // seen items are sorted, and the items are visited in increasing order
+        while ((next_seen[b] < seen_end) && (seen_items[next_seen[b]] < iid)) ++next_seen[b];
+        if ((next_seen[b] < seen_end) && (seen_items[next_seen[b]] == iid)) continue;
+
+        std::pair<double, int> c(s[j], iid);
+        if (heap.size() < K) {
+          heap.push_back(c);
+          std::push_heap(heap.begin(), heap.end(), score_greater);
+        }
+        else if (score_greater(c, heap.front())) {
+          std::pop_heap(heap.begin(), heap.end(), score_greater);
+          heap.back() = c;
+          std::push_heap(heap.begin(), heap.end(), score_greater);
+        }
+      }
+    }
+  }
+
+  for(int b=0; b<n_block; ++b) std::sort_heap(heaps[b].begin(), heaps[b].end(), score_greater);
+}
+
+enum recommend_format_t {RECOMMEND_TSV, RECOMMEND_BINARY};
+
+// Recommendation lists written through per-thread buffers of about flush_bytes, flushed to the
+// file one buffer at a time (users of different threads interleave by buffer).
+//   tsv    : "user<TAB>item<TAB>score" lines, 1-based ids, best first
+//   binary : int32 K, then per user int32 user, int32 n, n int32 items and n float scores
+class RecommendationWriter {
+  FILE *f;
+  recommend_format_t format;
+  size_t flush_bytes;
+
+  public:
+    RecommendationWriter() : f(NULL), format(RECOMMEND_TSV), flush_bytes(1 << 20) {}
+    ~RecommendationWriter() { close(); }
+
+    bool open(const std::string&, recommend_format_t, int);
+    void close();
+
+    void append(std::string&, int, const std::vector<std::pair<double, int> >&) const;
+    void flush(std::string&);
+    void add(std::string& buf, int uid, const std::vector<std::pair<double, int> >& top) {
+      append(buf, uid, top);
+      if (buf.size() >= flush_bytes) flush(buf);
+    }
+};
+
+bool RecommendationWriter::open(const std::string& filename, recommend_format_t fmt, int K) {
+  close();
+  f = fopen(filename.c_str(), "wb");
+  if (f == NULL) return false;
+  format = fmt;
+  if (format == RECOMMEND_BINARY) {
+    int32_t k = K;
+    fwrite(&k, sizeof(int32_t), 1, f);
+  }
+  return true;
+}
+
+void RecommendationWriter::close() {
+  if (f != NULL) fclose(f);
+  f = NULL;
+}
+
+void RecommendationWriter::append(std::string& buf, int uid, const std::vector<std::pair<double, int> >& top) const {
+  if (format == RECOMMEND_TSV) {
+    char line[64];
+    for(int j=0; j<top.size(); ++j) {
+      int len = snprintf(line, sizeof(line), "%d\t%d\t%.6g\n", uid+1, top[j].second+1, top[j].first);
+      buf.append(line, len);
+    }
+  }
+  else {
+    int32_t head[2] = { uid+1, (int32_t)top.size() };
+    buf.append((const char*)head, sizeof(head));
+    for(int j=0; j<top.size(); ++j) {
+      int32_t iid = top[j].second+1;
+      buf.append((const char*)&iid, sizeof(iid));
+    }
+    for(int j=0; j<top.size(); ++j) {
+      float s = (float)top[j].first;
+      buf.append((const char*)&s, sizeof(s));
+    }
+  }
+}
+
+void RecommendationWriter::flush(std::string& buf) {
+  #pragma omp critical (recommend_output)
+  fwrite(buf.data(), 1, buf.size(), f);
+  buf.clear();
+}
+
+#endif
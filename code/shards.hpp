@@ -0,0 +1,292 @@
+#ifndef __SHARDS_HPP__
+#define __SHARDS_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "elements.hpp"
+
+// Training comparisons kept on disk in shards of whole users, for data larger than memory.
+// Shard s holds the comparisons of users [uid_from[s], uid_from[s+1]) grouped by user, followed
+// by the two dual variables (V-step, U-step) of every comparison, which the solver writes back:
+//   comparison[n] | alphaV[n] | alphaU[n]
+// An index file (prefix.index) lists the shards and the size and modification time of the training
+// file they were built from; an existing index is reused while the training file is unchanged.
+class ShardedComparisons {
+  public:
+    std::string prefix;
+    int n_users, n_items;
+    long long n_comps;
+    std::vector<int>       uid_from;     // n_shards+1 user boundaries
+    std::vector<long long> size;         // comparisons per shard
+    long long source_size, source_mtime; // of the training file
+
+    ShardedComparisons() : n_users(0), n_items(0), n_comps(0), source_size(-1), source_mtime(-1) {}
+
+    int n_shards() const { return size.size(); }
+    std::string filename(int s) const { return prefix + ".shard" + std::to_string(s); }
+
+    bool load_index(const std::string&, const std::string&);
+    void build(const std::string&, const std::string&, long long);
+    void reset_duals() const;
+
+    void read(int, std::vector<comparison>&, std::vector<double>&, std::vector<double>&) const;
+    void write_duals(int, const std::vector<double>&, const std::vector<double>&) const;
+
+  private:
+    static bool source_stat(const std::string&, long long&, long long&);
+    void write_shard(const std::vector<comparison>&);
+    void write_index() const;
+};
+
+// size and modification time (sec) of a file, false if it cannot be stat'ed
+bool ShardedComparisons::source_stat(const std::string& file, long long& bytes, long long& mtime) {
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0) return false;
+  bytes = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+// false if there is no index, or it was built from another version of train_file
+bool ShardedComparisons::load_index(const std::string& pre, const std::string& train_file) {
+  prefix = pre;
+  std::ifstream f(prefix + ".index");
+  if (!f.is_open()) return false;
+
+  int n;
+  long long bytes, mtime;
+  if (!(f >> n_users >> n_items >> n_comps >> n >> source_size >> source_mtime)) {
+    printf("Shard index %s.index is unreadable or outdated, rebuilding\n", prefix.c_str());
+    return false;
+  }
+  if (source_stat(train_file, bytes, mtime) && ((bytes != source_size) || (mtime != source_mtime))) {
+    printf("Shard index %s.index was built from another version of %s, rebuilding\n", prefix.c_str(), train_file.c_str());
+    return false;
+  }
+  uid_from.assign(n+1, 0);
+  size.assign(n, 0);
+  for(int s=0; s<n; ++s) f >> uid_from[s] >> size[s];
+  uid_from[n] = n_users;
+
+  printf("%d users, %d items, %lld comparisons in %d shards (reused)\n", n_users, n_items, n_comps, n);
+  return true;
+}
+
+// Split a training file ("user item1 item2" lines grouped by user, as read by Problem::read_data)
+// into shards of about comps_per_shard comparisons.
+void ShardedComparisons::build(const std::string& train_file, const std::string& pre, long long comps_per_shard) {
+  prefix = pre;
+  n_users = n_items = 0;
+  n_comps = 0;
+  uid_from.assign(1, 0);
+  size.clear();
+  if (!source_stat(train_file, source_size, source_mtime)) source_size = source_mtime = -1;
+
+  std::ifstream f(train_file);
+  if (!f.is_open()) {
+    printf("Error in opening the training file!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<comparison> buf;
+  int uid, i1id, i2id, uid_current = -1, user_start = 0;
+  while (f >> uid >> i1id >> i2id) {
+    --uid; --i1id; --i2id;
+    if (uid != uid_current) {
+      std::sort(buf.begin()+user_start, buf.end(), comp_userwise);
+      if (buf.size() >= comps_per_shard) {
+        write_shard(buf);
+        uid_from.push_back(uid);
+        buf.clear();
+      }
+      uid_current = uid;
+      user_start = buf.size();
+    }
+
+    n_users = std::max(n_users, uid+1);
+    n_items = std::max(n_items, std::max(i1id, i2id)+1);
+    buf.push_back(comparison(uid, i1id, i2id, 1));
+  }
+  std::sort(buf.begin()+user_start, buf.end(), comp_userwise);
+  write_shard(buf);
+  uid_from.push_back(n_users);
+
+  write_index();
+  printf("%d users, %d items, %lld comparisons in %d shards\n", n_users, n_items, n_comps, n_shards());
+}
+
+void ShardedComparisons::write_shard(const std::vector<comparison>& buf) {
+  int s = size.size();
+  FILE *f = fopen(filename(s).c_str(), "wb");
+  if (f == NULL) {
+    printf("Error in opening the shard file!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<double> zeros(buf.size(), 0.);
+  fwrite(buf.data(), sizeof(comparison), buf.size(), f);
+  fwrite(zeros.data(), sizeof(double), zeros.size(), f);
+  fwrite(zeros.data(), sizeof(double), zeros.size(), f);
+  fclose(f);
+
+  size.push_back(buf.size());
+  n_comps += buf.size();
+}
+
+void ShardedComparisons::write_index() const {
+  FILE *f = fopen((prefix + ".index").c_str(), "w");
+  if (f == NULL) {
+    printf("Error in opening the shard index file!\n");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(f, "%d %d %lld %d %lld %lld\n", n_users, n_items, n_comps, n_shards(), source_size, source_mtime);
+  for(int s=0; s<n_shards(); ++s) fprintf(f, "%d %lld\n", uid_from[s], size[s]);
+  fclose(f);
+}
+
+void ShardedComparisons::reset_duals() const {
+  for(int s=0; s<n_shards(); ++s) {
+    std::vector<double> zeros(size[s], 0.);
+    write_duals(s, zeros, zeros);
+  }
+}
+
+void ShardedComparisons::read(int s, std::vector<comparison>& comps, std::vector<double>& alphaV, std::vector<double>& alphaU) const {
+  int fd = open(filename(s).c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("Error in opening the shard file!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long long n = size[s];
+  comps.resize(n);
+  alphaV.resize(n);
+  alphaU.resize(n);
+
+  bool ok = (pread(fd, comps.data(),  sizeof(comparison) * n, 0) == (ssize_t)(sizeof(comparison) * n))
+         && (pread(fd, alphaV.data(), sizeof(double) * n, sizeof(comparison) * n) == (ssize_t)(sizeof(double) * n))
+         && (pread(fd, alphaU.data(), sizeof(double) * n, (sizeof(comparison) + sizeof(double)) * n) == (ssize_t)(sizeof(double) * n));
+  close(fd);
+
+  if (!ok) {
+    printf("Error in reading the shard file!\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void ShardedComparisons::write_duals(int s, const std::vector<double>& alphaV, const std::vector<double>& alphaU) const {
+  int fd = open(filename(s).c_str(), O_WRONLY);
+  if (fd < 0) {
+    printf("Error in opening the shard file!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long long n = size[s];
+  bool ok = (pwrite(fd, alphaV.data(), sizeof(double) * n, sizeof(comparison) * n) == (ssize_t)(sizeof(double) * n))
+         && (pwrite(fd, alphaU.data(), sizeof(double) * n, (sizeof(comparison) + sizeof(double)) * n) == (ssize_t)(sizeof(double) * n));
+  close(fd);
+
+  if (!ok) {
+    printf("Error in writing the shard file!\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// one shard in memory
+struct ShardBuffer {
+  int shard;
+  std::vector<comparison> comps;
+  std::vector<double>     alphaV, alphaU;
+};
+
+// Reads the shards of one pass in order on a background thread, at most `depth` shards ahead
+// of the consumer. Buffers handed out by next() are given back with recycle().
+class ShardPrefetcher {
+  const ShardedComparisons& shards;
+  int depth, next_shard;
+  bool stop;
+
+  std::deque<ShardBuffer*> ready, free_list;
+  std::mutex m;
+  std::condition_variable cv;
+  std::thread reader;
+
+  void run();
+
+  public:
+    ShardPrefetcher(const ShardedComparisons& sh, int d) : shards(sh), depth(std::max(d, 1)), next_shard(0), stop(false) {
+      for(int i=0; i<depth; ++i) free_list.push_back(new ShardBuffer);
+      reader = std::thread(&ShardPrefetcher::run, this);
+    }
+    ~ShardPrefetcher();
+
+    ShardBuffer* next();
+    void recycle(ShardBuffer*);
+};
+
+void ShardPrefetcher::run() {
+  for(int s=0; s<shards.n_shards(); ++s) {
+    ShardBuffer *buf;
+    {
+      std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock, [this] { return stop || !free_list.empty(); });
+      if (stop) return;
+      buf = free_list.front();
+      free_list.pop_front();
+    }
+
+    buf->shard = s;
+    shards.read(s, buf->comps, buf->alphaV, buf->alphaU);
+
+    {
+      std::lock_guard<std::mutex> lock(m);
+      ready.push_back(buf);
+    }
+    cv.notify_all();
+  }
+}
+
+// the next shard of the pass, NULL at the end
+ShardBuffer* ShardPrefetcher::next() {
+  if (next_shard >= shards.n_shards()) return NULL;
+  std::unique_lock<std::mutex> lock(m);
+  cv.wait(lock, [this] { return !ready.empty(); });
+  ShardBuffer *buf = ready.front();
+  ready.pop_front();
+  ++next_shard;
+  return buf;
+}
+
+void ShardPrefetcher::recycle(ShardBuffer *buf) {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    free_list.push_back(buf);
+  }
+  cv.notify_all();
+}
+
+ShardPrefetcher::~ShardPrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    stop = true;
+  }
+  cv.notify_all();
+  reader.join();
+  for(int i=0; i<ready.size(); ++i) delete ready[i];
+  for(int i=0; i<free_list.size(); ++i) delete free_list[i];
+}
+
+#endif
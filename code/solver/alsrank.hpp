@@ -0,0 +1,214 @@
+#ifndef __ALSRANK_HPP__
+#define __ALSRANK_HPP__
+
+#include <omp.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "../elements.hpp"
+#include "../model.hpp"
+#include "../loss.hpp"
+#include "../linalg.hpp"
+#include "../problem.hpp"
+#include "../evaluator.hpp"
+#include "solver.hpp"
+#include "newton.hpp"
+
+// Alternating least squares on the squared pairwise loss
+//   min sum_i w_i/2 (1 - u_i.(v_i1 - v_i2))^2 + lambda/2 (|U|^2 + |V|^2)
+// U-step : every user is a ridge regression on the differences d_i = v_i1 - v_i2, solved exactly
+//          from its Gram matrix (sum_i w_i d_i d_i^T + lambda I) u = sum_i w_i d_i in one pass
+//          over its comparisons (batched Cholesky over the users).
+// V-step : one linear system in all item rows, solved for the update of V by conjugate gradient
+//          with the block-diagonal preconditioner of the per-item Gram matrices
+//          sum_{i of item j} w_i u_i u_i^T + lambda I (again batched Cholesky).
+class SolverALSRank : public Solver {
+  protected:
+    int    max_cg;
+    double cg_eps;
+
+    void solve_U(const Problem&, Model&);
+    int  solve_V(const Problem&, Model&, const ItemComparisons&);
+
+  public:
+    SolverALSRank() : Solver() {}
+    SolverALSRank(init_option_t init, int n_th, int m_it = 0, int cg = 10, double eps = 1e-3)
+      : Solver(init, m_it, n_th), max_cg(cg), cg_eps(eps) {}
+    void solve(Problem&, Model&, Evaluator*);
+};
+
+void SolverALSRank::solve_U(const Problem& prob, Model& model) {
+  int rank = model.rank;
+
+  #pragma omp parallel
+  {
+    std::vector<double> A(rank*rank), d(rank);
+
+    #pragma omp for schedule(dynamic, 64)
+    for(int uid=0; uid<n_users; ++uid) {
+      double *u = &model.U[(long long)uid * rank];
+      std::fill(A.begin(), A.end(), 0.);
+      memset(u, 0, sizeof(double) * rank);
+
+      for(int i=prob.tridx[uid]; i<prob.tridx[uid+1]; ++i) {
+        const double *v1 = &model.V[(long long)prob.train[i].item1_id * rank];
+        const double *v2 = &model.V[(long long)prob.train[i].item2_id * rank];
+        double w = prob.get_weight(i);
+        for(int k=0; k<rank; ++k) d[k] = v1[k] - v2[k];
+        for(int p=0; p<rank; ++p) {
+          u[p] += w * d[p];
+          for(int q=0; q<=p; ++q) A[p*rank+q] += w * d[p] * d[q];
+        }
+      }
+
+      for(int p=0; p<rank; ++p) A[p*rank+p] += lambda;
+      if (!cholesky_factor(A.data(), rank)) { memset(u, 0, sizeof(double) * rank); continue; }
+      cholesky_substitute(A.data(), rank, u);
+    }
+  }
+}
+
+// returns the number of CG iterations
+int SolverALSRank::solve_V(const Problem& prob, Model& model, const ItemComparisons& index) {
+  int rank = model.rank;
+  long long n = n_train_comps, n_rows = (long long)n_items * rank;
+  const double *U = model.U;
+  double *V = model.V;
+
+  std::vector<double> m(n), w(n);
+  std::vector<double> g(n_rows), x(n_rows, 0.), r(n_rows), z(n_rows), p(n_rows), Hp(n_rows);
+  std::vector<double> L((size_t)n_items * rank * rank);
+
+  // preconditioner blocks
+  #pragma omp parallel for schedule(dynamic, 64)
+  for(int iid=0; iid<n_items; ++iid) {
+    double *A = &L[(size_t)iid * rank * rank];
+    std::fill(A, A + rank*rank, 0.);
+    for(long long e=index.ptr[iid]; e<index.ptr[iid+1]; ++e) {
+      int i = index.comps[e];
+      const double *u = &U[(long long)prob.train[i].user_id * rank];
+      double wi = prob.get_weight(i);
+      for(int p=0; p<rank; ++p)
+        for(int q=0; q<=p; ++q) A[p*rank+q] += wi * u[p] * u[q];
+    }
+    for(int p=0; p<rank; ++p) A[p*rank+p] += lambda;
+    cholesky_factor(A, rank);
+  }
+  auto precondition = [&](const double *in, double *out) {
+    #pragma omp parallel for
+    for(int iid=0; iid<n_items; ++iid) {
+      memcpy(&out[(long long)iid * rank], &in[(long long)iid * rank], sizeof(double) * rank);
+      cholesky_substitute(&L[(size_t)iid * rank * rank], rank, &out[(long long)iid * rank]);
+    }
+  };
+  auto dot = [&](const double *a, const double *b) {
+    double s = 0.;
+    #pragma omp parallel for reduction(+:s)
+    for(long long k=0; k<n_rows; ++k) s += a[k] * b[k];
+    return s;
+  };
+
+  // gradient at V
+  pairwise_margins(prob, U, V, rank, m.data());
+  #pragma omp parallel for
+  for(long long i=0; i<n; ++i) w[i] = -prob.get_weight(i) * (1. - m[i]);
+  gather_items(prob, index, U, V, lambda, w.data(), rank, g.data());
+
+  #pragma omp parallel for
+  for(long long i=0; i<n; ++i) w[i] = prob.get_weight(i);
+
+  // preconditioned CG on H x = -g, to |r| <= cg_eps |g|
+  #pragma omp parallel for
+  for(long long k=0; k<n_rows; ++k) r[k] = -g[k];
+  double gnorm = sqrt(dot(g.data(), g.data()));
+  precondition(r.data(), z.data());
+  p = z;
+  double rz = dot(r.data(), z.data());
+
+  int n_cg = 0;
+  while ((n_cg < max_cg) && (gnorm > 0.)) {
+    pairwise_margins(prob, U, p.data(), rank, m.data());
+    #pragma omp parallel for
+    for(long long i=0; i<n; ++i) m[i] *= w[i];
+    gather_items(prob, index, U, p.data(), lambda, m.data(), rank, Hp.data());
+
+    double a = rz / dot(p.data(), Hp.data());
+    #pragma omp parallel for
+    for(long long k=0; k<n_rows; ++k) { x[k] += a * p[k]; r[k] -= a * Hp[k]; }
+    ++n_cg;
+    if (sqrt(dot(r.data(), r.data())) <= cg_eps * gnorm) break;
+
+    precondition(r.data(), z.data());
+    double rz_new = dot(r.data(), z.data());
+    double b = rz_new / rz;
+    rz = rz_new;
+    #pragma omp parallel for
+    for(long long k=0; k<n_rows; ++k) p[k] = z[k] + b * p[k];
+  }
+
+  #pragma omp parallel for
+  for(long long k=0; k<n_rows; ++k) V[k] += x[k];
+
+  return n_cg;
+}
+
+void SolverALSRank::solve(Problem& prob, Model& model, Evaluator* eval) {
+
+  use_objective(prob);
+  if (loss_option != SQUARED) {
+    printf("Error : alsrank needs the squared loss!\n");
+    return;
+  }
+
+  n_users = prob.n_users;
+  n_items = prob.n_items;
+  n_train_comps = prob.n_train_comps;
+
+  double f, f_old;
+
+  double time = omp_get_wtime();
+  initialize(prob, model, init_option);
+  time = omp_get_wtime() - time;
+
+  double time_phase = omp_get_wtime();
+  ItemComparisons index;
+  index.build(prob);
+  metrics.add_time("item_index", omp_get_wtime() - time_phase);
+
+  n_updates = 0;
+  trace.clear();
+  f_old = report(0, time, prob, model, eval);
+
+  for (int OuterIter = 1; OuterIter <= max_iter; ++OuterIter) {
+
+    // V-step
+    double time_single_iter = omp_get_wtime();
+    time_phase = omp_get_wtime();
+    metrics.add_count("cg_V", solve_V(prob, model, index));
+    metrics.add_time("solve_V", omp_get_wtime() - time_phase);
+    time = time + (omp_get_wtime() - time_single_iter);
+
+    f = report(OuterIter, time, prob, model, eval);
+    if (validation_stop(OuterIter)) break;
+
+    // U-step
+    time_single_iter = omp_get_wtime();
+    time_phase = omp_get_wtime();
+    solve_U(prob, model);
+    metrics.add_time("solve_U", omp_get_wtime() - time_phase);
+    time = time + (omp_get_wtime() - time_single_iter);
+
+    f = report(OuterIter, time, prob, model, eval);
+
+    // stopping rule
+    if (converged(f_old, f) || validation_stop(OuterIter)) break;
+    f_old = f;
+
+  }
+  restore_best(model);
+}
+
+#endif
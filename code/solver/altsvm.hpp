@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
+#include <algorithm>
 
 #include "../elements.hpp"
 #include "../model.hpp"
@@ -15,17 +17,127 @@
 #include "../problem.hpp"
 #include "../evaluator.hpp"
 #include "solver.hpp"
+#include "newton.hpp"
 
 class SolverAltSVM : public Solver {
   protected:
     double dcd_delta(loss_option_t, double, double, double, double);
+    void dcd_step_V(const Problem&, Model&, double*, int, double, int = 0);
+    void dcd_step_U(const Problem&, Model&, double*, int, double);
+    bool resample_V(Problem&, Model&, double*, int, std::mt19937&, int = 0);
+    bool resample_U(Problem&, Model&, double*, int, std::mt19937&);
+    double duality_gap(const Problem&, const Model&, const double*, const double*, long long, double) const;
+
+    // dual variables of the V- and U-steps, kept between solves with warm_start
+    std::vector<double> dual_V, dual_U;
+    bool warm_start = false;
+
+    // adaptive inner loop : each half-step repeats sweeps of n_train_comps DCD updates (at most
+    // max_inner_sweeps) until the relative duality gap of its subproblem is below gap_factor times
+    // the relative objective decrease of the previous outer iteration
+    bool      adaptive_sweeps = false;
+    double    gap_factor = .1;
+    int       max_inner_sweeps = 10;
+    long long gap_sample = 100000;
+
+    // engine of each half-step : dual coordinate descent, or truncated Newton on the primal (L2 hinge)
+    subsolver_option_t u_solver = SUBSOLVER_DCD, v_solver = SUBSOLVER_DCD;
+    NewtonOptions      newton;
 
   public:
     SolverAltSVM() : Solver() {}
     SolverAltSVM(init_option_t init, int n_th, int m_it = 0) : Solver(init, m_it, n_th) {}
     void solve(Problem&, Model&, Evaluator*);
+
+    // start the next solve from the current duals (and, with INIT_PREDETERMINED, the current model),
+    // e.g. along a path of lambda values on the same Problem
+    void set_warm_start(bool w) { warm_start = w; }
+    void set_adaptive_sweeps(bool a, double factor, int max_sweeps, long long sample) {
+      adaptive_sweeps = a; gap_factor = factor; max_inner_sweeps = std::max(max_sweeps, 1); gap_sample = sample;
+    }
+    void set_subsolvers(subsolver_option_t u, subsolver_option_t v, const NewtonOptions& opt) { u_solver = u; v_solver = v; newton = opt; }
+
+    // training comparisons with their duals (kept with warm_start), to resume training later, and
+    // the byte offset of incremental_file up to which its comparisons are included
+    bool write_state(const std::string&, const Problem&, long long = 0) const;
+    bool read_state(const std::string&, Problem&, long long&);
 };
 
+// int n_users, int n_items, long long n, double lambda, int loss, long long offset,
+// then comparison[n], alphaV[n], alphaU[n]
+bool SolverAltSVM::write_state(const std::string& file, const Problem& prob, long long offset) const {
+  long long n = prob.train.size();
+  if ((dual_V.size() != n) || !prob.weight.empty()) {
+    printf("Error : no dual state of the unweighted training comparisons to write!\n");
+    return false;
+  }
+
+  FILE *f = fopen(file.c_str(), "wb");
+  if (f == NULL) {
+    printf("Error in opening the state file!\n");
+    return false;
+  }
+  int header[2] = { prob.n_users, prob.n_items };
+  fwrite(header, sizeof(int), 2, f);
+  int loss = loss_option;
+  fwrite(&n, sizeof(long long), 1, f);
+  fwrite(&lambda, sizeof(double), 1, f);
+  fwrite(&loss, sizeof(int), 1, f);
+  fwrite(&offset, sizeof(long long), 1, f);
+  fwrite(prob.train.data(), sizeof(comparison), n, f);
+  fwrite(dual_V.data(), sizeof(double), n, f);
+  fwrite(dual_U.data(), sizeof(double), n, f);
+  fclose(f);
+  return true;
+}
+
+// replaces the training comparisons of prob (grouped by user) and the duals; the duals only hold
+// for the lambda and loss they were trained with, so a state of another objective than prob's is refused
+bool SolverAltSVM::read_state(const std::string& file, Problem& prob, long long& offset) {
+  FILE *f = fopen(file.c_str(), "rb");
+  if (f == NULL) {
+    printf("Error in opening the state file!\n");
+    return false;
+  }
+
+  int header[2], loss;
+  long long n;
+  double state_lambda;
+  bool ok = (fread(header, sizeof(int), 2, f) == 2) && (fread(&n, sizeof(long long), 1, f) == 1)
+    && (fread(&state_lambda, sizeof(double), 1, f) == 1) && (fread(&loss, sizeof(int), 1, f) == 1)
+    && (fread(&offset, sizeof(long long), 1, f) == 1) && (n >= 0);
+  if (ok && ((state_lambda != prob.lambda) || (loss != prob.loss_option))) {
+    printf("Error : the state file holds the duals of lambda = %g, loss %d, not of the configured lambda = %g, loss %d!\n",
+           state_lambda, loss, prob.lambda, (int)prob.loss_option);
+    fclose(f);
+    return false;
+  }
+  if (ok) {
+    prob.train.resize(n);
+    dual_V.resize(n);
+    dual_U.resize(n);
+    ok = (fread(prob.train.data(), sizeof(comparison), n, f) == n)
+      && (fread(dual_V.data(), sizeof(double), n, f) == n)
+      && (fread(dual_U.data(), sizeof(double), n, f) == n);
+  }
+  fclose(f);
+  if (!ok) {
+    printf("Error in reading the state file!\n");
+    return false;
+  }
+
+  prob.n_users = header[0];
+  prob.n_items = header[1];
+  prob.n_train_comps = n;
+  prob.weight.clear();
+  prob.tridx.assign(prob.n_users+1, 0);
+  for(long long i=0; i<n; ++i) ++prob.tridx[prob.train[i].user_id+1];
+  for(int uid=0; uid<prob.n_users; ++uid) prob.tridx[uid+1] += prob.tridx[uid];
+
+  printf("%d users, %d items, %lld comparisons with duals\n", prob.n_users, prob.n_items, n);
+  return true;
+}
+
 
 double SolverAltSVM::dcd_delta(loss_option_t loss_option, double alpha, double a, double b, double C) {
 
@@ -36,6 +148,7 @@ double SolverAltSVM::dcd_delta(loss_option_t loss_option, double alpha, double a
       // closed-form solution
       delta = (1. - b) / a; 
       delta = min(max(0., alpha + delta), C) - alpha;
+      break;
     case L2_HINGE:
       // closed-form solution
       delta = (1. - b - alpha*.5/C) / (a + .5/C);
@@ -54,9 +167,134 @@ double SolverAltSVM::dcd_delta(loss_option_t loss_option, double alpha, double a
 
 }
 
+// single dual coordinate update of comparison idx in the V-step (C is scaled by the comparison weight)
+inline void SolverAltSVM::dcd_step_V(const Problem& prob, Model& model, double *alphaV, int idx, double C, int i_thread) {
+  double *user_vec  = &(model.U[(long long)prob.train[idx].user_id  * model.rank]);
+  double *item1_vec = replicas.row(i_thread, prob.train[idx].item1_id, model.V, model.rank);
+  double *item2_vec = replicas.row(i_thread, prob.train[idx].item2_id, model.V, model.rank);
+
+  double p1 = 0., p2 = 0., d = 0.;
+  for(int j=0; j<model.rank; ++j) {
+    d = item1_vec[j] - item2_vec[j];
+    p1 += user_vec[j] * d;
+    p2 += user_vec[j] * user_vec[j];
+  } 
+
+  double delta = dcd_delta(loss_option, alphaV[idx], p2*2., p1, C * prob.get_weight(idx));
+
+  if (delta != 0.) { 
+    alphaV[idx] += delta;
+    for(int j=0; j<model.rank; ++j) {
+      d = delta * user_vec[j];
+      item1_vec[j] += d; 
+      item2_vec[j] -= d;
+    }
+  }
+}
+
+// single dual coordinate update of comparison idx in the U-step
+inline void SolverAltSVM::dcd_step_U(const Problem& prob, Model& model, double *alphaU, int idx, double C) {
+  double *user_vec  = &(model.U[(long long)prob.train[idx].user_id  * model.rank]);
+  double *item1_vec = &(model.V[(long long)prob.train[idx].item1_id * model.rank]);
+  double *item2_vec = &(model.V[(long long)prob.train[idx].item2_id * model.rank]);
+
+  double p1 = 0., p2 = 0., d = 0.;
+  for(int j=0; j<model.rank; ++j) {
+    d = item1_vec[j] - item2_vec[j];
+    p1 += user_vec[j] * d;
+    p2 += d*d;
+  } 
+
+  double delta = dcd_delta(loss_option, alphaU[idx], p2, p1, C * prob.get_weight(idx));
+
+  alphaU[idx] += delta;
+  for(int j=0; j<model.rank; ++j) {
+    d = delta * (item1_vec[j] - item2_vec[j]);
+    user_vec[j] += d;
+  }
+}
+
+// Implicit feedback : a fresh negative item for comparison idx. Its dual contribution is taken
+// out of V (U) first, so that the comparison restarts from alpha = 0 and V (U) stays the dual
+// combination of the current comparisons. False (slot unchanged, to be skipped) if no negative
+// was found. The slot is rewritten in the shared Problem, so only the thread that owns idx may
+// resample it.
+inline bool SolverAltSVM::resample_V(Problem& prob, Model& model, double *alphaV, int idx, std::mt19937& gen, int i_thread) {
+  comparison& c = prob.train[idx];
+  int neg = prob.implicit->sample(c.user_id, gen);
+  if (neg < 0) return false;
+  if (alphaV[idx] != 0.) {
+    double *user_vec  = &(model.U[(long long)c.user_id * model.rank]);
+    double *item1_vec = replicas.row(i_thread, c.item1_id, model.V, model.rank);
+    double *item2_vec = replicas.row(i_thread, c.item2_id, model.V, model.rank);
+    for(int j=0; j<model.rank; ++j) {
+      double d = alphaV[idx] * user_vec[j];
+      item1_vec[j] -= d;
+      item2_vec[j] += d;
+    }
+    alphaV[idx] = 0.;
+  }
+  c.item2_id = neg;
+  return true;
+}
+
+inline bool SolverAltSVM::resample_U(Problem& prob, Model& model, double *alphaU, int idx, std::mt19937& gen) {
+  comparison& c = prob.train[idx];
+  int neg = prob.implicit->sample(c.user_id, gen);
+  if (neg < 0) return false;
+  if (alphaU[idx] != 0.) {
+    double *user_vec  = &(model.U[(long long)c.user_id  * model.rank]);
+    double *item1_vec = &(model.V[(long long)c.item1_id * model.rank]);
+    double *item2_vec = &(model.V[(long long)c.item2_id * model.rank]);
+    for(int j=0; j<model.rank; ++j) user_vec[j] -= alphaU[idx] * (item1_vec[j] - item2_vec[j]);
+    alphaU[idx] = 0.;
+  }
+  c.item2_id = neg;
+  return true;
+}
+
+// Relative duality gap (P - D) / P of a half-step subproblem with the primal vectors W (V or U,
+// n_rows x rank) equal to the dual combination of alpha :
+//   P = 1/2 |W|^2 + sum_i C_i loss(1 - u_i.(v_i1 - v_i2)),  C_i = C w_i
+//   D = sum_i alpha_i - 1/2 |W|^2 (- sum_i alpha_i^2 / (4 C_i) for the squared hinge)
+// The loss sum is estimated on every stride-th comparison, stride = n_train_comps / gap_sample.
+double SolverAltSVM::duality_gap(const Problem& prob, const Model& model, const double *alpha, const double *W, long long n_rows, double C) const {
+  double normsq = 0.;
+  #pragma omp parallel for reduction(+:normsq)
+  for(long long i=0; i<n_rows * model.rank; ++i) normsq += W[i] * W[i];
+
+  long long stride = (gap_sample > 0) ? std::max(1LL, (long long)n_train_comps / gap_sample) : 1;
+  double sum_alpha = 0., sum_alpha2 = 0., loss = 0.;
+  long long n_sampled = 0;
+
+  #pragma omp parallel for reduction(+:sum_alpha,sum_alpha2,loss,n_sampled)
+  for(int i=0; i<n_train_comps; ++i) {
+    double w = prob.get_weight(i);
+    sum_alpha  += alpha[i];
+    sum_alpha2 += alpha[i] * alpha[i] / w;
+    if (i % stride != 0) continue;
+
+    const double *user_vec  = &(model.U[(long long)prob.train[i].user_id  * model.rank]);
+    const double *item1_vec = &(model.V[(long long)prob.train[i].item1_id * model.rank]);
+    const double *item2_vec = &(model.V[(long long)prob.train[i].item2_id * model.rank]);
+    double m = 0.;
+    for(int j=0; j<model.rank; ++j) m += user_vec[j] * (item1_vec[j] - item2_vec[j]);
+
+    double h = std::max(0., 1. - m);
+    loss += w * ((loss_option == L2_HINGE) ? h*h : h);
+    ++n_sampled;
+  }
+  if (n_sampled > 0) loss *= (double)n_train_comps / (double)n_sampled;
+
+  double primal = .5 * normsq + C * loss;
+  double gap = normsq + C * loss - sum_alpha;
+  if (loss_option == L2_HINGE) gap += sum_alpha2 / (4. * C);
+  return gap / std::max(primal, 1e-300);
+}
+
 void SolverAltSVM::solve(Problem& prob, Model& model, Evaluator* eval) {
 
-  double lambda = prob.lambda;
+  use_objective(prob);
   
   n_users = prob.n_users;
   n_items = prob.n_items;
@@ -64,10 +302,29 @@ void SolverAltSVM::solve(Problem& prob, Model& model, Evaluator* eval) {
 
   int n_max_updates = n_train_comps/n_threads;
 
-  double *alphaV = new double[this->n_train_comps];
-  double *alphaU = new double[this->n_train_comps];
-  memset(alphaU, 0, sizeof(double) * this->n_train_comps);
-  memset(alphaV, 0, sizeof(double) * this->n_train_comps);
+  if (!warm_start || (dual_V.size() != n_train_comps)) {
+    dual_V.assign(n_train_comps, 0.);
+    dual_U.assign(n_train_comps, 0.);
+  }
+  else if (loss_option == L1_HINGE) {
+    // the box constraint shrinks with a larger lambda
+    for(int i=0; i<n_train_comps; ++i) {
+      dual_V[i] = std::min(dual_V[i], prob.get_weight(i) / lambda);
+      dual_U[i] = std::min(dual_U[i], prob.get_weight(i) / lambda);
+    }
+  }
+  double *alphaV = dual_V.data();
+  double *alphaU = dual_U.data();
+
+  if (n_hot_items > 0) {
+    std::vector<int> n_comps_by_item(n_items, 0);
+    for(int i=0; i<n_train_comps; ++i) {
+      ++n_comps_by_item[prob.train[i].item1_id];
+      ++n_comps_by_item[prob.train[i].item2_id];
+    }
+    // V is the sum of the dual contributions, so the replicas are always delta-summed
+    replicas.select(n_comps_by_item, n_hot_items, n_threads, model.rank, MERGE_SUM);
+  }
 
   // Alternating RankSVM
   double f, f_old;
@@ -76,13 +333,24 @@ void SolverAltSVM::solve(Problem& prob, Model& model, Evaluator* eval) {
   initialize(prob, model, init_option);
   time = omp_get_wtime() - time;
 
-  printf("0, %f, ", time);
-  f_old = prob.evaluate(model);
-  if (eval != NULL) eval->evaluate(model);
-  printf("\n");
+  n_updates = 0;
+  trace.clear();
+  f_old = report(0, time, prob, model, eval);
+
+  // the gap is only defined for the hinge losses
+  bool adaptive = adaptive_sweeps && ((loss_option == L1_HINGE) || (loss_option == L2_HINGE));
+  int n_sweeps_max = adaptive ? max_inner_sweeps : 1;
+  double progress = 1.;
+
+  // the Newton steps need the smooth L2 hinge
+  bool newton_U = (u_solver == SUBSOLVER_NEWTON) && (loss_option == L2_HINGE);
+  bool newton_V = (v_solver == SUBSOLVER_NEWTON) && (loss_option == L2_HINGE);
+  ItemComparisons item_index;
+  if (newton_V) item_index.build(prob);
 
   double normsq;
   for (int OuterIter = 1; OuterIter <= max_iter; ++OuterIter) {
+    double gap_target = gap_factor * progress;
 
     ///////////////////////////
     // Learning V 
@@ -90,65 +358,79 @@ void SolverAltSVM::solve(Problem& prob, Model& model, Evaluator* eval) {
     
     double time_single_iter = omp_get_wtime(); 
     
-    // initialize using the previous alphaV
-    memset(model.V, 0, sizeof(double) * n_items * model.rank);
-    
-    #pragma omp parallel for
-    for(int i=0; i<n_train_comps; ++i) {
-      double *user_vec  = &(model.U[prob.train[i].user_id  * model.rank]);
-      double *item1_vec = &(model.V[prob.train[i].item1_id * model.rank]);
-      double *item2_vec = &(model.V[prob.train[i].item2_id * model.rank]);
-      //if (alphaV[i] > 1e-10) {
-        for(int j=0; j<model.rank; ++j) {
-          double d = alphaV[i] * user_vec[j];
-          item1_vec[j] += d;
-          item2_vec[j] -= d;
-        }
-      //}
-    }		
-
-    // DUAL COORDINATE DESCENT for V
-    #pragma omp parallel
-    {
-      int i_thread = omp_get_thread_num();
-
-      std::mt19937 gen(n_threads*OuterIter + i_thread);
-      std::uniform_int_distribution<int> randidx(0, n_train_comps-1);
-
-      for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
-        int idx = randidx(gen);
-        double *user_vec  = &(model.U[prob.train[idx].user_id  * model.rank]);
-        double *item1_vec = &(model.V[prob.train[idx].item1_id * model.rank]);
-        double *item2_vec = &(model.V[prob.train[idx].item2_id * model.rank]);
+    double time_phase;
+    if (newton_V) {
+      time_phase = omp_get_wtime();
+      long long n_cg = 0;
+      metrics.add_count("newton_V", newton_solve_V(prob, model, 1./lambda, newton, item_index, alphaV, n_cg));
+      metrics.add_count("cg_V", n_cg);
+      metrics.add_time("solve_V", omp_get_wtime() - time_phase);
+    }
+    else {
+      // initialize using the previous alphaV
+      time_phase = omp_get_wtime();
+      memset(model.V, 0, sizeof(double) * n_items * model.rank);
     
-        double p1 = 0., p2 = 0., d = 0.;
-        for(int j=0; j<model.rank; ++j) {
-          d = item1_vec[j] - item2_vec[j];
-          p1 += user_vec[j] * d;
-          p2 += user_vec[j] * user_vec[j];
-        } 
-
-        double delta = dcd_delta(prob.loss_option, alphaV[idx], p2*2., p1, 1./lambda);
-
-        if (delta != 0.) { 
-          alphaV[idx] += delta;
+      #pragma omp parallel for
+      for(int i=0; i<n_train_comps; ++i) {
+        double *user_vec  = &(model.U[(long long)prob.train[i].user_id  * model.rank]);
+        double *item1_vec = &(model.V[(long long)prob.train[i].item1_id * model.rank]);
+        double *item2_vec = &(model.V[(long long)prob.train[i].item2_id * model.rank]);
+        //if (alphaV[i] > 1e-10) {
           for(int j=0; j<model.rank; ++j) {
-            d = delta * user_vec[j];
-            item1_vec[j] += d; 
+            double d = alphaV[i] * user_vec[j];
+            item1_vec[j] += d;
             item2_vec[j] -= d;
           }
+        //}
+      }		
+      metrics.add_time("rebuild_V", omp_get_wtime() - time_phase);
+
+      // DUAL COORDINATE DESCENT for V
+      time_phase = omp_get_wtime();
+      for(int sweep=0; sweep<n_sweeps_max; ++sweep) {
+        #pragma omp parallel
+        {
+          int i_thread = omp_get_thread_num();
+
+          // implicit feedback rewrites the negatives of the drawn slots : every thread draws from
+          // its own range of comparisons
+          int idx_from = 0, idx_to = n_train_comps;
+          if (prob.implicit != NULL) {
+            idx_from = (long long)n_train_comps * i_thread / n_threads;
+            idx_to   = (long long)n_train_comps * (i_thread+1) / n_threads;
+          }
+
+          std::mt19937 gen(n_threads*(OuterIter + sweep*(max_iter+1)) + i_thread);
+          std::uniform_int_distribution<int> randidx(idx_from, idx_to-1);
+          UpcomingComparisons upcoming;
+
+          replicas.pull(i_thread, model.V);
+          for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
+            int idx = upcoming.next(gen, randidx, prob.train, model, prefetch_batch);
+            if ((prob.implicit == NULL) || resample_V(prob, model, alphaV, idx, gen, i_thread))
+              dcd_step_V(prob, model, alphaV, idx, 1./lambda, i_thread);
+            if (replicas.enabled() && ((n_updates+1) % hot_sync_every == 0)) replicas.sync(i_thread, model.V);
+          }
+          replicas.push(i_thread, model.V);
+
         }
-      }
+        n_updates += (long long)n_max_updates * n_threads;
+        metrics.add_count("updates", (long long)n_max_updates * n_threads);
+        metrics.add_count("sweeps_V", 1);
 
-    }
+        if (adaptive && (duality_gap(prob, model, alphaV, model.V, n_items, 1./lambda) <= gap_target)) break;
+      }
+      metrics.add_time("solve_V", omp_get_wtime() - time_phase);
     
+    }
+
     time = time + (omp_get_wtime() - time_single_iter);
+    if (metrics.enabled()) metrics.add_count("nnz_alphaV", count_nonzeros(alphaV, n_train_comps));
 
     // compute performance measure
-    printf("%d, %f, ", OuterIter, time);
-    f = prob.evaluate(model);
-    if (eval != NULL) eval->evaluate(model);
-    printf("\n");
+    f = report(OuterIter, time, prob, model, eval);
+    if (validation_stop(OuterIter)) break;
  
     ///////////////////////////
     // Learning U 
@@ -156,70 +438,77 @@ void SolverAltSVM::solve(Problem& prob, Model& model, Evaluator* eval) {
     
     time_single_iter = omp_get_wtime();
  
-    // initialize U using the previous alphaU 
-    memset(model.U, 0, sizeof(double) * n_users * model.rank);
-    
-    #pragma omp parallel for
-    for(int i=0; i<n_train_comps; ++i) {
-      //if (alphaU[i] > 1e-10) {
-        double *user_vec  = &(model.U[prob.train[i].user_id  * model.rank]);
-        double *item1_vec = &(model.V[prob.train[i].item1_id * model.rank]);
-        double *item2_vec = &(model.V[prob.train[i].item2_id * model.rank]);
-        for(int j=0; j<model.rank; ++j) {
-          user_vec[j] += alphaU[i] * (item1_vec[j] - item2_vec[j]);  
-        }
-      //}
+    if (newton_U) {
+      time_phase = omp_get_wtime();
+      metrics.add_count("newton_U", newton_solve_U(prob, model, 1./lambda, newton, alphaU));
+      metrics.add_time("solve_U", omp_get_wtime() - time_phase);
     }
-
-    // DUAL COORDINATE DESCENT for U
-    #pragma omp parallel
-    {
-      int i_thread = omp_get_thread_num();
-      int uid_from = (n_users * i_thread / n_threads);
-      int uid_to   = (n_users * (i_thread+1) / n_threads);
-
-      std::mt19937 gen(n_threads*OuterIter + i_thread);
-      std::uniform_int_distribution<int> randidx(prob.tridx[uid_from], prob.tridx[uid_to]-1);
-
-      for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
-        int idx = randidx(gen);
-        double *user_vec  = &(model.U[prob.train[idx].user_id  * model.rank]);
-        double *item1_vec = &(model.V[prob.train[idx].item1_id * model.rank]);
-        double *item2_vec = &(model.V[prob.train[idx].item2_id * model.rank]);
+    else {
+      // initialize U using the previous alphaU 
+      time_phase = omp_get_wtime();
+      memset(model.U, 0, sizeof(double) * n_users * model.rank);
     
-        double p1 = 0., p2 = 0., d = 0.;
-        for(int j=0; j<model.rank; ++j) {
-          d = item1_vec[j] - item2_vec[j];
-          p1 += user_vec[j] * d;
-          p2 += d*d;
-        } 
-
-        double delta = dcd_delta(prob.loss_option, alphaU[idx], p2, p1, 1./lambda);
-
-        alphaU[idx] += delta;
-        for(int j=0; j<model.rank; ++j) {
-          d = delta * (item1_vec[j] - item2_vec[j]);
-          user_vec[j] += d;
+      #pragma omp parallel for
+      for(int i=0; i<n_train_comps; ++i) {
+        //if (alphaU[i] > 1e-10) {
+          double *user_vec  = &(model.U[(long long)prob.train[i].user_id  * model.rank]);
+          double *item1_vec = &(model.V[(long long)prob.train[i].item1_id * model.rank]);
+          double *item2_vec = &(model.V[(long long)prob.train[i].item2_id * model.rank]);
+          for(int j=0; j<model.rank; ++j) {
+            user_vec[j] += alphaU[i] * (item1_vec[j] - item2_vec[j]);  
+          }
+        //}
+      }
+      metrics.add_time("rebuild_U", omp_get_wtime() - time_phase);
+
+      // DUAL COORDINATE DESCENT for U
+      time_phase = omp_get_wtime();
+      for(int sweep=0; sweep<n_sweeps_max; ++sweep) {
+        #pragma omp parallel
+        {
+          int i_thread = omp_get_thread_num();
+          int uid_from = (n_users * i_thread / n_threads);
+          int uid_to   = (n_users * (i_thread+1) / n_threads);
+
+          std::mt19937 gen(n_threads*(OuterIter + sweep*(max_iter+1)) + i_thread);
+          std::uniform_int_distribution<int> randidx(prob.tridx[uid_from], prob.tridx[uid_to]-1);
+          UpcomingComparisons upcoming;
+
+          for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
+            int idx = upcoming.next(gen, randidx, prob.train, model, prefetch_batch);
+            if ((prob.implicit == NULL) || resample_U(prob, model, alphaU, idx, gen))
+              dcd_step_U(prob, model, alphaU, idx, 1./lambda);
+          }
         }
+        n_updates += (long long)n_max_updates * n_threads;
+        metrics.add_count("updates", (long long)n_max_updates * n_threads);
+        metrics.add_count("sweeps_U", 1);
+
+        if (adaptive && (duality_gap(prob, model, alphaU, model.U, n_users, 1./lambda) <= gap_target)) break;
       }
-		}
+      metrics.add_time("solve_U", omp_get_wtime() - time_phase);
+
+    }
 
     time = time + (omp_get_wtime() - time_single_iter);
+    if (metrics.enabled()) metrics.add_count("nnz_alphaU", count_nonzeros(alphaU, n_train_comps));
 
     // compute performance measure 
-    printf("%d, %f, ", OuterIter, time);
-    f = prob.evaluate(model);
-    if (eval != NULL) eval->evaluate(model);
-    printf("\n");
+    f = report(OuterIter, time, prob, model, eval);
  
    // stopping rule
-    if ((f_old - f) / f_old < 1e-5) break;
+    if (converged(f_old, f) || validation_stop(OuterIter)) break;
+    progress = (f_old - f) / f_old;
     f_old = f;
   
   }
+  restore_best(model);
+  replicas.clear();
 
-	delete [] alphaV;
-	delete [] alphaU;
+  if (!warm_start) {
+    std::vector<double>().swap(dual_V);
+    std::vector<double>().swap(dual_U);
+  }
 }	
 
 #endif
@@ -0,0 +1,210 @@
+#ifndef __ALTSVM_INCREMENTAL_HPP__
+#define __ALTSVM_INCREMENTAL_HPP__
+
+#include <random>
+#include <omp.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "../elements.hpp"
+#include "../model.hpp"
+#include "../random.hpp"
+#include "../problem.hpp"
+#include "../evaluator.hpp"
+#include "altsvm.hpp"
+
+// AltSVM on a growing set of comparisons. append() merges new comparisons into a Problem whose
+// duals come from read_state (or an earlier solve), with zero duals, and marks their users as
+// affected. solve() then runs n_sweeps DCD sweeps restricted to the comparisons of the affected
+// users (V-step : the item rows they touch, rebuilt from alphaV for the current U, U-step : their
+// user rows, rebuilt from alphaU), and n_refresh warm-started outer iterations of SolverAltSVM over
+// all comparisons. The rows nobody touches keep the V of the last V-step that updated them.
+class SolverAltSVMIncremental : public SolverAltSVM {
+  int n_sweeps, n_refresh;
+  std::vector<int> affected_users;
+
+  public:
+    SolverAltSVMIncremental(int n_th, int sweeps, int refresh)
+      : SolverAltSVM(INIT_PREDETERMINED, n_th, refresh), n_sweeps(sweeps), n_refresh(refresh) { warm_start = true; }
+
+    int append(Problem&, Model&, const std::vector<comparison>&);
+    void solve(Problem&, Model&, Evaluator*);
+};
+
+// merge new comparisons (0-based ids) into prob after those of the same user; the model grows
+// for new users and items, whose rows are initialized as by INIT_RANDOM. Returns the number of
+// affected users.
+int SolverAltSVMIncremental::append(Problem& prob, Model& model, const std::vector<comparison>& comps) {
+  int nu = prob.n_users, ni = prob.n_items;
+  for(int i=0; i<comps.size(); ++i) {
+    nu = std::max(nu, comps[i].user_id+1);
+    ni = std::max(ni, std::max(comps[i].item1_id, comps[i].item2_id)+1);
+  }
+
+  std::vector<int> n_new(nu, 0);
+  for(int i=0; i<comps.size(); ++i) ++n_new[comps[i].user_id];
+
+  std::vector<int> tridx(nu+1, 0);
+  for(int uid=0; uid<nu; ++uid) {
+    int n_old = (uid < prob.n_users) ? prob.tridx[uid+1] - prob.tridx[uid] : 0;
+    tridx[uid+1] = tridx[uid] + n_old + n_new[uid];
+  }
+
+  std::vector<comparison> train(tridx[nu]);
+  std::vector<double> aV(tridx[nu], 0.), aU(tridx[nu], 0.);
+  std::vector<int> pos(tridx.begin(), tridx.end()-1);
+  for(int uid=0; uid<prob.n_users; ++uid) {
+    for(int i=prob.tridx[uid]; i<prob.tridx[uid+1]; ++i) {
+      train[pos[uid]] = prob.train[i];
+      aV[pos[uid]] = dual_V[i];
+      aU[pos[uid]] = dual_U[i];
+      ++pos[uid];
+    }
+  }
+  for(int i=0; i<comps.size(); ++i) train[pos[comps[i].user_id]++] = comps[i];
+
+  affected_users.clear();
+  for(int uid=0; uid<nu; ++uid) if (n_new[uid] > 0) affected_users.push_back(uid);
+
+  // grow the model
+  if ((nu > model.n_users) || (ni > model.n_items)) {
+    int nu_old = model.n_users, ni_old = model.n_items;
+    std::vector<double> U(model.U, model.U + (long long)nu_old * model.rank), V(model.V, model.V + (long long)ni_old * model.rank);
+    model.allocate(std::max(nu, nu_old), std::max(ni, ni_old));
+    memcpy(model.U, U.data(), sizeof(double) * U.size());
+    memcpy(model.V, V.data(), sizeof(double) * V.size());
+
+    for(int uid=nu_old; uid<model.n_users; ++uid) {
+      double *u = &model.U[(long long)uid * model.rank];
+      philox_uniform(init_seed, 0, uid, u, model.rank);
+      for(int k=0; k<model.rank; ++k) u[k] /= sqrt((double)model.rank);
+    }
+    for(int iid=ni_old; iid<model.n_items; ++iid) {
+      double *v = &model.V[(long long)iid * model.rank];
+      philox_uniform(init_seed, 1, iid, v, model.rank);
+      for(int k=0; k<model.rank; ++k) v[k] /= sqrt((double)model.rank);
+    }
+  }
+
+  prob.train.swap(train);
+  prob.tridx.swap(tridx);
+  prob.n_users = nu;
+  prob.n_items = ni;
+  prob.n_train_comps = prob.train.size();
+  dual_V.swap(aV);
+  dual_U.swap(aU);
+
+  return affected_users.size();
+}
+
+void SolverAltSVMIncremental::solve(Problem& prob, Model& model, Evaluator* eval) {
+
+  use_objective(prob);
+
+  n_users = prob.n_users;
+  n_items = prob.n_items;
+  n_train_comps = prob.n_train_comps;
+
+  double *alphaV = dual_V.data();
+  double *alphaU = dual_U.data();
+
+  // comparisons of the affected users
+  std::vector<int> local;
+  for(int a=0; a<affected_users.size(); ++a)
+    for(int i=prob.tridx[affected_users[a]]; i<prob.tridx[affected_users[a]+1]; ++i) local.push_back(i);
+  int n_local = local.size();
+  int n_max_updates = n_local / n_threads;
+
+  // the items of these comparisons, with all of their comparisons
+  std::vector<int> touched;
+  ItemComparisons index;
+  if ((n_local > 0) && (n_sweeps > 0)) {
+    std::vector<char> is_touched(n_items, 0);
+    for(int e=0; e<n_local; ++e) is_touched[prob.train[local[e]].item1_id] = is_touched[prob.train[local[e]].item2_id] = 1;
+    for(int iid=0; iid<n_items; ++iid) if (is_touched[iid]) touched.push_back(iid);
+    index.build(prob);
+  }
+
+  double time = 0.;
+  n_updates = 0;
+  trace.clear();
+  if (n_local > 0) report(0, time, prob, model, eval);
+
+  for (int sweep = 1; (sweep <= n_sweeps) && (n_local > 0); ++sweep) {
+
+    // the touched item rows : rebuild from alphaV, then DCD for V on the comparisons of the affected users
+    double time_single_iter = omp_get_wtime();
+    #pragma omp parallel for schedule(dynamic,64)
+    for(int t=0; t<touched.size(); ++t) {
+      int iid = touched[t];
+      double *item_vec = &(model.V[(long long)iid * model.rank]);
+      memset(item_vec, 0, sizeof(double) * model.rank);
+      for(long long e=index.ptr[iid]; e<index.ptr[iid+1]; ++e) {
+        int i = index.comps[e];
+        double a = (prob.train[i].item1_id == iid) ? alphaV[i] : -alphaV[i];
+        double *user_vec = &(model.U[(long long)prob.train[i].user_id * model.rank]);
+        for(int j=0; j<model.rank; ++j) item_vec[j] += a * user_vec[j];
+      }
+    }
+
+    #pragma omp parallel
+    {
+      int i_thread = omp_get_thread_num();
+      std::mt19937 gen(n_threads*sweep + i_thread);
+      std::uniform_int_distribution<int> randidx(0, n_local-1);
+
+      for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
+        dcd_step_V(prob, model, alphaV, local[randidx(gen)], 1./lambda, i_thread);
+      }
+    }
+
+    // the affected users : rebuild from alphaU, then DCD on their comparisons
+    #pragma omp parallel
+    {
+      int i_thread = omp_get_thread_num();
+      int a_from = (affected_users.size() * i_thread / n_threads);
+      int a_to   = (affected_users.size() * (i_thread+1) / n_threads);
+
+      std::vector<int> mine;
+      for(int a=a_from; a<a_to; ++a) {
+        int uid = affected_users[a];
+        double *user_vec = &(model.U[(long long)uid * model.rank]);
+        memset(user_vec, 0, sizeof(double) * model.rank);
+        for(int i=prob.tridx[uid]; i<prob.tridx[uid+1]; ++i) {
+          double *item1_vec = &(model.V[(long long)prob.train[i].item1_id * model.rank]);
+          double *item2_vec = &(model.V[(long long)prob.train[i].item2_id * model.rank]);
+          for(int j=0; j<model.rank; ++j) user_vec[j] += alphaU[i] * (item1_vec[j] - item2_vec[j]);
+          mine.push_back(i);
+        }
+      }
+
+      if (!mine.empty()) {
+        std::mt19937 gen(n_threads*sweep + i_thread);
+        std::uniform_int_distribution<int> randidx(0, mine.size()-1);
+        for(int n_updates=0; n_updates<mine.size(); ++n_updates) {
+          dcd_step_U(prob, model, alphaU, mine[randidx(gen)], 1./lambda);
+        }
+      }
+    }
+    n_updates += 2 * (long long)n_local;
+    metrics.add_count("updates", 2 * (long long)n_local);
+    time += omp_get_wtime() - time_single_iter;
+
+    report(sweep, time, prob, model, eval);
+  }
+
+  // global refresh from the current duals and model
+  if (n_refresh > 0) {
+    std::vector<trace_point> local_trace;
+    local_trace.swap(trace);
+    init_option = INIT_PREDETERMINED;
+    max_iter = n_refresh;
+    SolverAltSVM::solve(prob, model, eval);
+    trace.insert(trace.begin(), local_trace.begin(), local_trace.end());
+  }
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef __ALTSVM_OOC_HPP__
+#define __ALTSVM_OOC_HPP__
+
+#include <random>
+#include <omp.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "../elements.hpp"
+#include "../model.hpp"
+#include "../loss.hpp"
+#include "../problem.hpp"
+#include "../evaluator.hpp"
+#include "../shards.hpp"
+#include "altsvm.hpp"
+
+// AltSVM over disk-resident shards (see ShardedComparisons) : only U, V and a bounded number of
+// shard buffers are in memory, and the dual variables live in the shard files.
+// Every outer iteration makes sequential passes over the shards :
+//   V-step : rebuild V from alphaV, then DCD shard by shard (duals written back)
+//   U-step : rebuild the users of a shard from alphaU and run DCD on them, shard by shard
+// plus one pass per reported objective value. The Problem only carries the sizes, lambda and loss.
+class SolverAltSVMOOC : public SolverAltSVM {
+  const ShardedComparisons& shards;
+  int n_buffers;
+
+  double objective(Problem&, Model&);
+
+  void pass_rebuild_V(Model&);
+  void pass_solve_V(Model&, int);
+  void pass_U(Model&, int);
+
+  public:
+    SolverAltSVMOOC(const ShardedComparisons& sh, int n_buf, init_option_t init, int n_th, int m_it = 0)
+      : SolverAltSVM(init, n_th, m_it), shards(sh), n_buffers(n_buf) {}
+    void solve(Problem&, Model&, Evaluator*);
+};
+
+double SolverAltSVMOOC::objective(Problem& prob, Model& model) {
+  double l = 0.;
+  ShardPrefetcher prefetch(shards, n_buffers);
+  for(ShardBuffer *buf = prefetch.next(); buf != NULL; buf = prefetch.next()) {
+    l += compute_loss(model, buf->comps, loss_option);
+    prefetch.recycle(buf);
+  }
+  return l + .5*lambda*(model.Unormsq() + model.Vnormsq());
+}
+
+void SolverAltSVMOOC::pass_rebuild_V(Model& model) {
+  memset(model.V, 0, sizeof(double) * n_items * model.rank);
+
+  ShardPrefetcher prefetch(shards, n_buffers);
+  for(ShardBuffer *buf = prefetch.next(); buf != NULL; buf = prefetch.next()) {
+    const std::vector<comparison>& comps = buf->comps;
+    const double *alphaV = buf->alphaV.data();
+
+    #pragma omp parallel for
+    for(long long i=0; i<comps.size(); ++i) {
+      double *user_vec  = &(model.U[(long long)comps[i].user_id  * model.rank]);
+      double *item1_vec = &(model.V[(long long)comps[i].item1_id * model.rank]);
+      double *item2_vec = &(model.V[(long long)comps[i].item2_id * model.rank]);
+      for(int j=0; j<model.rank; ++j) {
+        double d = alphaV[i] * user_vec[j];
+        item1_vec[j] += d;
+        item2_vec[j] -= d;
+      }
+    }
+    prefetch.recycle(buf);
+  }
+}
+
+void SolverAltSVMOOC::pass_solve_V(Model& model, int OuterIter) {
+  Problem part;
+  ShardPrefetcher prefetch(shards, n_buffers);
+  for(ShardBuffer *buf = prefetch.next(); buf != NULL; buf = prefetch.next()) {
+    int n = buf->comps.size();
+    int n_max_updates = n / n_threads;
+    part.train.swap(buf->comps);
+    double *alphaV = buf->alphaV.data();
+
+    #pragma omp parallel
+    {
+      int i_thread = omp_get_thread_num();
+
+      std::mt19937 gen(n_threads*(OuterIter*shards.n_shards()+buf->shard) + i_thread);
+      std::uniform_int_distribution<int> randidx(0, n-1);
+
+      for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
+        dcd_step_V(part, model, alphaV, randidx(gen), 1./lambda, i_thread);
+      }
+    }
+    n_updates += (long long)n_max_updates * n_threads;
+    metrics.add_count("updates", (long long)n_max_updates * n_threads);
+
+    part.train.swap(buf->comps);
+    shards.write_duals(buf->shard, buf->alphaV, buf->alphaU);
+    prefetch.recycle(buf);
+  }
+}
+
+void SolverAltSVMOOC::pass_U(Model& model, int OuterIter) {
+  Problem part;
+  ShardPrefetcher prefetch(shards, n_buffers);
+  for(ShardBuffer *buf = prefetch.next(); buf != NULL; buf = prefetch.next()) {
+    int s = buf->shard;
+    int uid_from = shards.uid_from[s], n_shard_users = shards.uid_from[s+1] - uid_from;
+    int n = buf->comps.size();
+    int n_max_updates = n / n_threads;
+    double *alphaU = buf->alphaU.data();
+
+    // comparisons of user uid_from+k are [tridx[k], tridx[k+1])
+    std::vector<int> tridx(n_shard_users+1, 0);
+    for(int i=0; i<n; ++i) ++tridx[buf->comps[i].user_id - uid_from + 1];
+    for(int k=0; k<n_shard_users; ++k) tridx[k+1] += tridx[k];
+    part.train.swap(buf->comps);
+
+    #pragma omp parallel
+    {
+      int i_thread = omp_get_thread_num();
+      int k_from = (n_shard_users * i_thread / n_threads);
+      int k_to   = (n_shard_users * (i_thread+1) / n_threads);
+
+      // rebuild the users of this thread from alphaU
+      for(int k=k_from; k<k_to; ++k) {
+        double *user_vec = &(model.U[(long long)(uid_from+k) * model.rank]);
+        memset(user_vec, 0, sizeof(double) * model.rank);
+        for(int i=tridx[k]; i<tridx[k+1]; ++i) {
+          double *item1_vec = &(model.V[(long long)part.train[i].item1_id * model.rank]);
+          double *item2_vec = &(model.V[(long long)part.train[i].item2_id * model.rank]);
+          for(int j=0; j<model.rank; ++j) user_vec[j] += alphaU[i] * (item1_vec[j] - item2_vec[j]);
+        }
+      }
+
+      if (tridx[k_to] > tridx[k_from]) {
+        std::mt19937 gen(n_threads*(OuterIter*shards.n_shards()+s) + i_thread);
+        std::uniform_int_distribution<int> randidx(tridx[k_from], tridx[k_to]-1);
+
+        for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
+          dcd_step_U(part, model, alphaU, randidx(gen), 1./lambda);
+        }
+      }
+    }
+    n_updates += (long long)n_max_updates * n_threads;
+    metrics.add_count("updates", (long long)n_max_updates * n_threads);
+
+    part.train.swap(buf->comps);
+    shards.write_duals(s, buf->alphaV, buf->alphaU);
+    prefetch.recycle(buf);
+  }
+}
+
+void SolverAltSVMOOC::solve(Problem& prob, Model& model, Evaluator* eval) {
+
+  use_objective(prob);
+
+  n_users = prob.n_users;
+  n_items = prob.n_items;
+  n_train_comps = prob.n_train_comps;
+
+  if (!warm_start) shards.reset_duals();
+
+  double f, f_old;
+
+  double time = omp_get_wtime();
+  initialize(prob, model, init_option);
+  time = omp_get_wtime() - time;
+
+  n_updates = 0;
+  trace.clear();
+  f_old = report(0, time, prob, model, eval);
+
+  for (int OuterIter = 1; OuterIter <= max_iter; ++OuterIter) {
+
+    // Learning V
+    double time_single_iter = omp_get_wtime();
+    double time_phase = omp_get_wtime();
+    pass_rebuild_V(model);
+    metrics.add_time("rebuild_V", omp_get_wtime() - time_phase);
+
+    time_phase = omp_get_wtime();
+    pass_solve_V(model, OuterIter);
+    metrics.add_time("solve_V", omp_get_wtime() - time_phase);
+    time = time + (omp_get_wtime() - time_single_iter);
+
+    f = report(OuterIter, time, prob, model, eval);
+
+    // Learning U
+    time_single_iter = omp_get_wtime();
+    pass_U(model, OuterIter);
+    metrics.add_time("solve_U", omp_get_wtime() - time_single_iter);
+    time = time + (omp_get_wtime() - time_single_iter);
+
+    f = report(OuterIter, time, prob, model, eval);
+
+    // stopping rule
+    if (converged(f_old, f)) break;
+    f_old = f;
+  }
+}
+
+#endif
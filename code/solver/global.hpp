@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
+#include <unordered_map>
 
 #include "../elements.hpp"
 #include "../model.hpp"
@@ -16,9 +18,16 @@
 #include "../evaluator.hpp"
 #include "solver.hpp"
 
+// All users share one user vector, so comparisons of the same (item1, item2) pair are
+// interchangeable : they are collapsed into one weighted comparison (user 0) with one dual variable.
 class SolverGlobal : public Solver {
   protected:
+    std::vector<comparison> pairs;
+    std::vector<double>     pair_weight;      // summed weights of the collapsed comparisons
+
     double dcd_delta(loss_option_t, double, double, double, double);
+    void aggregate(const Problem&);
+    double objective(Problem&, Model&);
 
   public:
     SolverGlobal() : Solver() {}
@@ -35,6 +44,7 @@ double SolverGlobal::dcd_delta(loss_option_t loss_option, double alpha, double a
       // closed-form solution
       delta = (1. - b) / a; 
       delta = min(max(0., alpha + delta), C) - alpha;
+      break;
     case L2_HINGE:
       // closed-form solution
       delta = (1. - b - alpha*.5/C) / (a + .5/C);
@@ -53,71 +63,91 @@ double SolverGlobal::dcd_delta(loss_option_t loss_option, double alpha, double a
 
 }
 
+void SolverGlobal::aggregate(const Problem& prob) {
+  ScopedTimer timer("aggregate");
+
+  unordered_map<long long, int> index;
+  index.reserve(prob.train.size() / 4);
+  pairs.clear();
+  pair_weight.clear();
+
+  for(int i=0; i<prob.train.size(); ++i) {
+    long long key = (long long)prob.train[i].item1_id * (long long)(1u<<31) + prob.train[i].item2_id;
+    auto it = index.find(key);
+    if (it == index.end()) {
+      index.emplace(key, (int)pairs.size());
+      pairs.push_back(comparison(0, prob.train[i].item1_id, prob.train[i].item2_id, 1));
+      pair_weight.push_back(prob.get_weight(i));
+    }
+    else {
+      pair_weight[it->second] += prob.get_weight(i);
+    }
+  }
+
+  metrics.add_count("unique_pairs", pairs.size());
+}
+
+// same value as Problem::evaluate, from the collapsed pairs
+double SolverGlobal::objective(Problem& prob, Model& model) {
+  double l = compute_loss(model, pairs, loss_option, pair_weight.data());
+  return l + .5*lambda*(model.Unormsq() + model.Vnormsq());
+}
+
 void SolverGlobal::solve(Problem& prob, Model& model, Evaluator* eval) {
 
-  double lambda = prob.lambda;
+  use_objective(prob);
   
   n_users = prob.n_users;
   n_items = prob.n_items;
   n_train_comps = prob.n_train_comps; 
 
-  int n_max_updates = n_train_comps/n_threads;
-
-  double *alphaV = new double[this->n_train_comps];
-  memset(alphaV, 0, sizeof(double) * this->n_train_comps);
-
   double start = omp_get_wtime();
   double f, f_old;
 
-  initialize(prob, model, init_option);
+  aggregate(prob);
+  int n_pairs = pairs.size();
+  int n_max_updates = n_pairs/n_threads;
+
+  std::vector<double> alphaV(n_pairs, 0.);
 
-  printf("0, %f, ", omp_get_wtime() - start);
-  f_old = prob.evaluate(model);
-  eval->evaluate(model);
-  printf("\n");
+  // one user vector for everybody : all ones unless a model was given, then its first user
+  initialize(prob, model, (init_option == INIT_PREDETERMINED) ? INIT_PREDETERMINED : INIT_ALLONES);
+  const double *user_vec = model.U;
+  for(int uid=1; uid<n_users; ++uid) memcpy(&model.U[(long long)uid * model.rank], user_vec, sizeof(double) * model.rank);
+
+  double p2 = 0.;
+  for(int j=0; j<model.rank; ++j) p2 += user_vec[j] * user_vec[j];
+
+  n_updates = 0;
+  trace.clear();
+  f_old = report(0, omp_get_wtime() - start, prob, model, eval);
 
   memset(model.V, 0, sizeof(double) * n_items * model.rank);
-  #pragma omp parallel for
-  for(int i=0; i<n_train_comps; ++i) {
-    double *user_vec  = &(model.U[prob.train[i].user_id  * model.rank]);
-    double *item1_vec = &(model.V[prob.train[i].item1_id * model.rank]);
-    double *item2_vec = &(model.V[prob.train[i].item2_id * model.rank]);
-    for(int j=0; j<model.rank; ++j) {
-      double d = alphaV[i] * user_vec[j];
-      item1_vec[j] += d;
-      item2_vec[j] -= d;
-    }
-  }		
 
-  double normsq;
   for (int OuterIter = 1; OuterIter <= max_iter; ++OuterIter) {
 
     ///////////////////////////
     // Learning V 
     ///////////////////////////
      
-    // DUAL COORDINATE DESCENT for V
+    // DUAL COORDINATE DESCENT for V over the unique pairs
+    double time_phase = omp_get_wtime();
     #pragma omp parallel
     {
       int i_thread = omp_get_thread_num();
 
       std::mt19937 gen(n_threads*OuterIter + i_thread);
-      std::uniform_int_distribution<int> randidx(0, n_train_comps-1);
+      std::uniform_int_distribution<int> randidx(0, n_pairs-1);
 
       for(int n_updates=0; n_updates<n_max_updates; ++n_updates) {
         int idx = randidx(gen);
-        double *user_vec  = &(model.U[prob.train[idx].user_id  * model.rank]);
-        double *item1_vec = &(model.V[prob.train[idx].item1_id * model.rank]);
-        double *item2_vec = &(model.V[prob.train[idx].item2_id * model.rank]);
+        double *item1_vec = &(model.V[(long long)pairs[idx].item1_id * model.rank]);
+        double *item2_vec = &(model.V[(long long)pairs[idx].item2_id * model.rank]);
     
-        double p1 = 0., p2 = 0., d = 0.;
-        for(int j=0; j<model.rank; ++j) {
-          d = item1_vec[j] - item2_vec[j];
-          p1 += user_vec[j] * d;
-          p2 += user_vec[j] * user_vec[j];
-        } 
+        double p1 = 0., d = 0.;
+        for(int j=0; j<model.rank; ++j) p1 += user_vec[j] * (item1_vec[j] - item2_vec[j]);
 
-        double delta = dcd_delta(prob.loss_option, alphaV[idx], p2*2., p1, 1./lambda);
+        double delta = dcd_delta(loss_option, alphaV[idx], p2*2., p1, pair_weight[idx]/lambda);
 
         if (delta != 0.) { 
           alphaV[idx] += delta;
@@ -130,21 +160,24 @@ void SolverGlobal::solve(Problem& prob, Model& model, Evaluator* eval) {
       }
 
     }
+    metrics.add_time("solve_V", omp_get_wtime() - time_phase);
+    n_updates += (long long)n_max_updates * n_threads;
+    metrics.add_count("updates", (long long)n_max_updates * n_threads);
+    if (metrics.enabled()) metrics.add_count("nnz_alphaV", count_nonzeros(alphaV.data(), n_pairs));
 
     // compute performance measure
-    printf("%d, %f, ", OuterIter, omp_get_wtime() - start);
-    f = prob.evaluate(model);
-    eval->evaluate(model);
-    printf("\n");
+    f = report(OuterIter, omp_get_wtime() - start, prob, model, eval);
  
-    // stopping rule
-    if ((f_old - f) / f_old < 1e-5) break;
+    // stopping rule; f_old of iteration 0 was taken before V was reset, so the first sweep
+    // has nothing to be compared with
+    if (((OuterIter > 1) && converged(f_old, f)) || validation_stop(OuterIter)) break;
     f_old = f;
   
   }
+  restore_best(model);
 
-	delete [] alphaV;
+  std::vector<comparison>().swap(pairs);
+  std::vector<double>().swap(pair_weight);
 }	
 
 #endif
-
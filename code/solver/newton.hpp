@@ -0,0 +1,241 @@
+#ifndef __NEWTON_HPP__
+#define __NEWTON_HPP__
+
+#include <omp.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "../elements.hpp"
+#include "../model.hpp"
+#include "../problem.hpp"
+#include "../linalg.hpp"
+
+// Truncated Newton steps on the primal L2-hinge subproblems of AltSVM (C = 1/lambda, C_i = C w_i)
+//   U-step, every user : min 1/2 |u|^2 + sum_i C_i max(0, 1 - u.d_i)^2,  d_i = v_i1 - v_i2
+//   V-step             : min 1/2 |V|^2 + sum_i C_i max(0, 1 - u_i.(v_i1 - v_i2))^2
+// The generalized Hessian is I + 2 sum_i C_i x_i x_i^T over the comparisons with a positive hinge.
+// The U-step solves the rank x rank Newton system of every user by Cholesky, the V-step runs
+// conjugate gradient on Hessian-vector products. Both take Armijo backtracking steps along the
+// Newton direction and stop when |grad| <= eps |grad at the start|. On return the duals hold
+// the optimality condition alpha_i = 2 C_i max(0, 1 - margin_i), as DCD would have them.
+
+enum subsolver_option_t {SUBSOLVER_DCD, SUBSOLVER_NEWTON};
+
+struct NewtonOptions {
+  int    max_iter;    // Newton iterations per phase
+  int    max_cg;      // conjugate gradient iterations per Newton iteration (V-step)
+  double eps;         // relative gradient tolerance
+
+  NewtonOptions() : max_iter(5), max_cg(20), eps(1e-3) {}
+};
+
+// out_i = u_i.(X_i1 - X_i2) for every comparison i, in contiguous blocks of the comparison store
+void pairwise_margins(const Problem& prob, const double *U, const double *X, int rank, double *out) {
+  #pragma omp parallel for schedule(static)
+  for(long long i=0; i<prob.n_train_comps; ++i) {
+    const comparison& c = prob.train[i];
+    const double *u = &U[(long long)c.user_id * rank];
+    const double *x1 = &X[(long long)c.item1_id * rank], *x2 = &X[(long long)c.item2_id * rank];
+    double zi = 0.;
+    for(int k=0; k<rank; ++k) zi += u[k] * (x1[k] - x2[k]);
+    out[i] = zi;
+  }
+}
+
+// out_j = scale X_j + sum_{comparisons i of item j} (+/-) w_i u_i (+ as item1, - as item2), item by item
+void gather_items(const Problem& prob, const ItemComparisons& index, const double *U, const double *X, double scale,
+                  const double *w, int rank, double *out) {
+  #pragma omp parallel for schedule(dynamic, 256)
+  for(int iid=0; iid<prob.n_items; ++iid) {
+    double *o = &out[(long long)iid * rank];
+    const double *x = &X[(long long)iid * rank];
+    for(int k=0; k<rank; ++k) o[k] = scale * x[k];
+    for(long long e=index.ptr[iid]; e<index.ptr[iid+1]; ++e) {
+      int i = index.comps[e];
+      if (w[i] == 0.) continue;
+      const comparison& c = prob.train[i];
+      double wi = (c.item1_id == iid) ? w[i] : -w[i];
+      const double *u = &U[(long long)c.user_id * rank];
+      for(int k=0; k<rank; ++k) o[k] += wi * u[k];
+    }
+  }
+}
+
+static double newton_dot(const double *a, const double *b, long long n) {
+  double s = 0.;
+  #pragma omp parallel for reduction(+:s)
+  for(long long i=0; i<n; ++i) s += a[i] * b[i];
+  return s;
+}
+
+// Armijo backtracking on f(t) = 1/2 (xx + 2t xs + t^2 ss) + sum_i C_i max(0, 1 - m_i - t z_i)^2
+// (x.x = xx, x.s = xs, s.s = ss) from f(0) = f0 with slope g.s < 0
+static double newton_line_search(const double *m, const double *z, const double *Ci, long long n,
+                                 double xx, double xs, double ss, double f0, double slope, bool parallel) {
+  double t = 1.;
+  for(int k=0; k<30; ++k, t*=.5) {
+    double loss = 0.;
+    #pragma omp parallel for reduction(+:loss) if (parallel)
+    for(long long i=0; i<n; ++i) {
+      double h = 1. - m[i] - t * z[i];
+      if (h > 0.) loss += Ci[i] * h * h;
+    }
+    if (.5 * (xx + 2.*t*xs + t*t*ss) + loss <= f0 + 1e-2 * t * slope) return t;
+  }
+  return 0.;
+}
+
+// Newton steps on every user row, V fixed. Returns the number of Newton iterations.
+long long newton_solve_U(const Problem& prob, Model& model, double C, const NewtonOptions& opt, double *alphaU) {
+  int rank = model.rank;
+  long long n_iters = 0;
+
+  #pragma omp parallel reduction(+:n_iters)
+  {
+    std::vector<double> H(rank*rank), g(rank), s(rank), d, m, z, Ci;
+
+    #pragma omp for schedule(dynamic, 64)
+    for(int uid=0; uid<prob.n_users; ++uid) {
+      int from = prob.tridx[uid], n = prob.tridx[uid+1] - from;
+      double *u = &model.U[(long long)uid * rank];
+      if (n == 0) { memset(u, 0, sizeof(double) * rank); continue; }
+
+      d.resize((size_t)n * rank); m.resize(n); z.resize(n); Ci.resize(n);
+      for(int i=0; i<n; ++i) {
+        const comparison& c = prob.train[from+i];
+        const double *v1 = &model.V[(long long)c.item1_id * rank], *v2 = &model.V[(long long)c.item2_id * rank];
+        for(int k=0; k<rank; ++k) d[(size_t)i*rank+k] = v1[k] - v2[k];
+        Ci[i] = C * prob.get_weight(from+i);
+      }
+
+      double g0 = 0.;
+      for(int iter=0; iter<=opt.max_iter; ++iter) {
+        double loss = 0.;
+        for(int k=0; k<rank; ++k) g[k] = u[k];
+        std::fill(H.begin(), H.end(), 0.);
+        for(int i=0; i<n; ++i) {
+          const double *di = &d[(size_t)i*rank];
+          double mi = 0.;
+          for(int k=0; k<rank; ++k) mi += u[k] * di[k];
+          m[i] = mi;
+          double h = 1. - mi;
+          if (h <= 0.) continue;
+          loss += Ci[i] * h * h;
+          for(int k=0; k<rank; ++k) g[k] -= 2. * Ci[i] * h * di[k];
+          for(int p=0; p<rank; ++p)
+            for(int q=0; q<=p; ++q) H[p*rank+q] += 2. * Ci[i] * di[p] * di[q];
+        }
+
+        double gnorm = 0., uu = 0.;
+        for(int k=0; k<rank; ++k) { gnorm += g[k] * g[k]; uu += u[k] * u[k]; }
+        gnorm = sqrt(gnorm);
+        if (iter == 0) g0 = gnorm;
+        if ((iter == opt.max_iter) || (gnorm <= opt.eps * g0) || (gnorm == 0.)) break;
+
+        for(int p=0; p<rank; ++p) {
+          H[p*rank+p] += 1.;
+          for(int q=0; q<p; ++q) H[q*rank+p] = H[p*rank+q];
+        }
+        for(int k=0; k<rank; ++k) s[k] = -g[k];
+        if (!cholesky_solve(H.data(), rank, s.data())) break;
+
+        double us = 0., ss = 0., slope = 0.;
+        for(int k=0; k<rank; ++k) { us += u[k] * s[k]; ss += s[k] * s[k]; slope += g[k] * s[k]; }
+        for(int i=0; i<n; ++i) {
+          double zi = 0.;
+          for(int k=0; k<rank; ++k) zi += s[k] * d[(size_t)i*rank+k];
+          z[i] = zi;
+        }
+        double t = newton_line_search(m.data(), z.data(), Ci.data(), n, uu, us, ss, .5 * uu + loss, slope, false);
+        if (t == 0.) break;
+        for(int k=0; k<rank; ++k) u[k] += t * s[k];
+        ++n_iters;
+      }
+
+      for(int i=0; i<n; ++i) {
+        double mi = 0.;
+        for(int k=0; k<rank; ++k) mi += u[k] * d[(size_t)i*rank+k];
+        alphaU[from+i] = 2. * Ci[i] * std::max(0., 1. - mi);
+      }
+    }
+  }
+
+  return n_iters;
+}
+
+// Newton-CG steps on V, U fixed. A Hessian-vector product is two passes, neither with
+// conflicting writes : the margins of the direction per comparison (in contiguous blocks of the
+// comparison store), then a gather of the active comparisons per item row through the index.
+// Returns the number of Newton iterations; the CG iterations are added to n_cg.
+long long newton_solve_V(const Problem& prob, Model& model, double C, const NewtonOptions& opt, const ItemComparisons& index,
+                         double *alphaV, long long& n_cg) {
+  int rank = model.rank;
+  long long n = prob.n_train_comps, n_rows = (long long)prob.n_items * rank;
+  const double *U = model.U;
+  double *V = model.V;
+
+  std::vector<double> m(n), z(n), Ci(n), coef(n);
+  std::vector<double> g(n_rows), s(n_rows), r(n_rows), p(n_rows), Hp(n_rows);
+
+  #pragma omp parallel for
+  for(long long i=0; i<n; ++i) Ci[i] = C * prob.get_weight(i);
+
+  double g0 = 0.;
+  long long n_iters = 0;
+  for(int iter=0; iter<=opt.max_iter; ++iter) {
+    pairwise_margins(prob, U, V, rank, m.data());
+    double loss = 0.;
+    #pragma omp parallel for reduction(+:loss)
+    for(long long i=0; i<n; ++i) {
+      double h = std::max(0., 1. - m[i]);
+      loss += Ci[i] * h * h;
+      coef[i] = -2. * Ci[i] * h;
+    }
+    gather_items(prob, index, U, V, 1., coef.data(), rank, g.data());
+
+    double gnorm = sqrt(newton_dot(g.data(), g.data(), n_rows));
+    if (iter == 0) g0 = gnorm;
+    if ((iter == opt.max_iter) || (gnorm <= opt.eps * g0) || (gnorm == 0.)) break;
+
+    // conjugate gradient on H s = -g, to |r| <= 0.1 |g|
+    std::fill(s.begin(), s.end(), 0.);
+    #pragma omp parallel for
+    for(long long k=0; k<n_rows; ++k) { r[k] = -g[k]; p[k] = r[k]; }
+    double rr = gnorm * gnorm;
+    for(int cg=0; cg<opt.max_cg; ++cg) {
+      pairwise_margins(prob, U, p.data(), rank, z.data());
+      #pragma omp parallel for
+      for(long long i=0; i<n; ++i) z[i] = (m[i] < 1.) ? 2. * Ci[i] * z[i] : 0.;
+      gather_items(prob, index, U, p.data(), 1., z.data(), rank, Hp.data());
+
+      double a = rr / newton_dot(p.data(), Hp.data(), n_rows);
+      #pragma omp parallel for
+      for(long long k=0; k<n_rows; ++k) { s[k] += a * p[k]; r[k] -= a * Hp[k]; }
+      double rr_new = newton_dot(r.data(), r.data(), n_rows);
+      ++n_cg;
+      if (sqrt(rr_new) <= .1 * gnorm) break;
+
+      double b = rr_new / rr;
+      rr = rr_new;
+      #pragma omp parallel for
+      for(long long k=0; k<n_rows; ++k) p[k] = r[k] + b * p[k];
+    }
+
+    pairwise_margins(prob, U, s.data(), rank, z.data());
+    double vv = newton_dot(V, V, n_rows), vs = newton_dot(V, s.data(), n_rows), ss = newton_dot(s.data(), s.data(), n_rows);
+    double t = newton_line_search(m.data(), z.data(), Ci.data(), n, vv, vs, ss, .5 * vv + loss, newton_dot(g.data(), s.data(), n_rows), true);
+    if (t == 0.) break;
+    #pragma omp parallel for
+    for(long long k=0; k<n_rows; ++k) V[k] += t * s[k];
+    ++n_iters;
+  }
+
+  #pragma omp parallel for
+  for(long long i=0; i<n; ++i) alphaV[i] = 2. * Ci[i] * std::max(0., 1. - m[i]);
+
+  return n_iters;
+}
+
+#endif
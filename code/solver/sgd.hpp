@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <cmath>
 #include <algorithm>
 #include <vector>
 
@@ -20,24 +21,135 @@
 
 using namespace std;
 
+enum stepsize_option_t {STEP_SCHEDULE, STEP_ADAGRAD, STEP_RMSPROP, STEP_ADAM};
+
+// Per-coordinate optimizer state, laid out exactly like Model::U and Model::V.
+// Updated lock-free together with the model (Hogwild).
+class AdaptiveState {
+  public:
+    bool is_allocated;
+    int n_users, n_items, rank;
+    double *gU, *gV;                // sum (AdaGrad) or moving average (RMSProp, Adam) of squared gradients
+    double *mU, *mV;                // moving average of gradients (Adam)
+    int *tU, *tV;                   // number of updates per row (Adam bias correction)
+
+    AdaptiveState() : is_allocated(false) {}
+    ~AdaptiveState() { de_allocate(); }
+
+    void allocate(int nu, int ni, int r, bool momentum);
+    void de_allocate();
+};
+
+void AdaptiveState::allocate(int nu, int ni, int r, bool momentum) {
+  if (is_allocated) de_allocate();
+
+  n_users = nu;
+  n_items = ni;
+  rank    = r;
+
+  gU = new double[(size_t)nu * r];
+  gV = new double[(size_t)ni * r];
+  memset(gU, 0, sizeof(double) * nu * r);
+  memset(gV, 0, sizeof(double) * ni * r);
+
+  mU = mV = NULL;
+  tU = tV = NULL;
+  if (momentum) {
+    mU = new double[(size_t)nu * r];
+    mV = new double[(size_t)ni * r];
+    tU = new int[nu];
+    tV = new int[ni];
+    memset(mU, 0, sizeof(double) * nu * r);
+    memset(mV, 0, sizeof(double) * ni * r);
+    memset(tU, 0, sizeof(int) * nu);
+    memset(tV, 0, sizeof(int) * ni);
+  }
+
+  is_allocated = true;
+}
+
+void AdaptiveState::de_allocate() {
+  if (!is_allocated) return;
+
+  delete [] gU;
+  delete [] gV;
+  if (mU != NULL) delete [] mU;
+  if (mV != NULL) delete [] mV;
+  if (tU != NULL) delete [] tU;
+  if (tV != NULL) delete [] tV;
+
+  is_allocated = false;
+}
+
 class SolverSGD : public Solver {
   protected:
     double alpha, beta;
-    
+    stepsize_option_t stepsize_option;
+
+    // RMSProp uses rho, Adam uses beta1 and beta2
+    double rho = .9, beta1 = .9, beta2 = .999, eps = 1e-8;
+
     vector<int> n_comps_by_user, n_comps_by_item;    
 
-    bool sgd_step(Model&, const comparison&, loss_option_t, double, double);
+    AdaptiveState state;
+
+    // each row of U and V is stored as scale * vec during an epoch, folded by fold_scales
+    // between epochs; a scale does not drop below rescale_threshold within an epoch
+    vector<double> scale_U, scale_V;
+    double rescale_threshold = 1e-6;
+
+    void rescale_row(double*, double&, int);
+    void fold_scales(Model&);
+
+    void prepare(Problem&, Model&);
+    double adaptive_dir(double, double*, double*, double, double);
+    bool sgd_step(Model&, const comparison&, loss_option_t, double, double, double = 1., int = 0);
  
   public:
     SolverSGD() : Solver() {}
-    SolverSGD(double alp, double bet, init_option_t init, int n_th, int m_it = 0) : Solver(init, m_it, n_th), alpha(alp), beta(bet) {}
+    SolverSGD(double alp, double bet, stepsize_option_t st, init_option_t init, int n_th, int m_it = 0) : Solver(init, m_it, n_th), alpha(alp), beta(bet), stepsize_option(st) {}
     void solve(Problem&, Model&, Evaluator* eval);
 };
 
-bool SolverSGD::sgd_step(Model& model, const comparison& comp, loss_option_t loss_option, double l, double step_size) {
-  double *user_vec  = &(model.U[comp.user_id  * model.rank]);
-  double *item1_vec = &(model.V[comp.item1_id * model.rank]);
-  double *item2_vec = &(model.V[comp.item2_id * model.rank]);
+// scale a single gradient coordinate according to the stepsize option
+// bc1, bc2 : Adam bias corrections of the row
+inline double SolverSGD::adaptive_dir(double g, double *acc, double *mom, double bc1, double bc2) {
+  switch(stepsize_option) {
+    case STEP_SCHEDULE:
+      return g;
+    case STEP_ADAGRAD:
+      *acc += g*g;
+      return g / (sqrt(*acc) + eps);
+    case STEP_RMSPROP:
+      *acc = rho * *acc + (1.-rho) * g*g;
+      return g / (sqrt(*acc) + eps);
+    case STEP_ADAM:
+      *mom = beta1 * *mom + (1.-beta1) * g;
+      *acc = beta2 * *acc + (1.-beta2) * g*g;
+      return (*mom / bc1) / (sqrt(*acc / bc2) + eps);
+  }
+  return g;
+}
+
+// fold the scalar multiplier of a row into its coordinates
+inline void SolverSGD::rescale_row(double *vec, double& scale, int rank) {
+  for(int k=0; k<rank; k++) vec[k] *= scale;
+  scale = 1.;
+}
+
+void SolverSGD::fold_scales(Model& model) {
+  #pragma omp parallel for
+  for(int uid=0; uid<n_users; ++uid) rescale_row(&(model.U[(long long)uid * model.rank]), scale_U[uid], model.rank);
+  #pragma omp parallel for
+  for(int iid=0; iid<n_items; ++iid) rescale_row(&(model.V[(long long)iid * model.rank]), scale_V[iid], model.rank);
+}
+
+// Rows are stored as (scale * vec), so the L2 shrink of a row only touches its scale
+// w : importance weight of the comparison, i_thread : owner of the hot item replicas to update
+bool SolverSGD::sgd_step(Model& model, const comparison& comp, loss_option_t loss_option, double l, double step_size, double w, int i_thread) {
+  double *user_vec  = &(model.U[(long long)comp.user_id  * model.rank]);
+  double *item1_vec = replicas.row(i_thread, comp.item1_id, model.V, model.rank);
+  double *item2_vec = replicas.row(i_thread, comp.item2_id, model.V, model.rank);
 
   int n_comps_user  = n_comps_by_user[comp.user_id];
   int n_comps_item1 = n_comps_by_item[comp.item1_id];
@@ -45,10 +157,17 @@ bool SolverSGD::sgd_step(Model& model, const comparison& comp, loss_option_t los
 
   if ((n_comps_user < 1) || (n_comps_item1 < 1) || (n_comps_item2 < 1)) printf("ERROR\n");
 
+  double &scale_user  = scale_U[comp.user_id];
+  double &scale_item1 = *replicas.row_scale(i_thread, comp.item1_id, scale_V.data());
+  double &scale_item2 = *replicas.row_scale(i_thread, comp.item2_id, scale_V.data());
+
+  double su = scale_user, s1 = scale_item1, s2 = scale_item2;
+
   double prod = 0.;
-  for(int k=0; k<model.rank; k++) prod += user_vec[k] * comp.comp * (item1_vec[k] - item2_vec[k]);
+  for(int k=0; k<model.rank; k++) prod += user_vec[k] * (s1 * item1_vec[k] - s2 * item2_vec[k]);
+  prod *= su * comp.comp;
 
-  if (prod != prod) return false;
+  if (!std::isfinite(prod)) return false;
 
   double grad = 0.;
   switch(loss_option) {
@@ -66,75 +185,161 @@ bool SolverSGD::sgd_step(Model& model, const comparison& comp, loss_option_t los
   }
 
   if (grad != 0.) {
-    for(int k=0; k<model.rank; k++) {
-	    double user_dir  = step_size * (grad * comp.comp * (item1_vec[k] - item2_vec[k]) + l / (double)n_comps_user * user_vec[k]);
-      double item1_dir = step_size * (grad * comp.comp * user_vec[k] + l / (double)n_comps_item1 * item1_vec[k]);
-      double item2_dir = step_size * (grad * -comp.comp * user_vec[k] + l / (double)n_comps_item2 * item2_vec[k]);
-
-	    user_vec[k]  -= user_dir;
-	    item1_vec[k] -= item1_dir;
-      item2_vec[k] -= item2_dir;
+    // regularization : multiplicative shrink of the scales (decoupled from the adaptive scaling)
+    // rows are only folded at the end of an epoch (another thread may be using the scale), so the
+    // scale is held at rescale_threshold instead
+    double su_new = max(su * max(1. - step_size * l / (double)n_comps_user,  0.), rescale_threshold);
+    double s1_new = max(s1 * max(1. - step_size * l / (double)n_comps_item1, 0.), rescale_threshold);
+    double s2_new = max(s2 * max(1. - step_size * l / (double)n_comps_item2, 0.), rescale_threshold);
+
+    double cg = grad * comp.comp * w;
+    double step_user  = step_size / su_new;
+    double step_item1 = step_size / s1_new;
+    double step_item2 = step_size / s2_new;
+
+    if (stepsize_option == STEP_SCHEDULE) {
+      for(int k=0; k<model.rank; k++) {
+        double user_grad = cg * (s1 * item1_vec[k] - s2 * item2_vec[k]);
+        double item_grad = cg * su * user_vec[k];
+
+	      user_vec[k]  -= step_user  * user_grad;
+	      item1_vec[k] -= step_item1 * item_grad;
+        item2_vec[k] += step_item2 * item_grad;
+      }
+    }
+    else {
+      long long offset_user  = (long long)comp.user_id  * model.rank;
+      long long offset_item1 = (long long)comp.item1_id * model.rank;
+      long long offset_item2 = (long long)comp.item2_id * model.rank;
+
+      double bc1_user = 1., bc2_user = 1., bc1_item1 = 1., bc2_item1 = 1., bc1_item2 = 1., bc2_item2 = 1.;
+      if (stepsize_option == STEP_ADAM) {
+        int t_user  = ++state.tU[comp.user_id];
+        int t_item1 = ++state.tV[comp.item1_id];
+        int t_item2 = ++state.tV[comp.item2_id];
+        bc1_user  = 1. - pow(beta1, t_user);  bc2_user  = 1. - pow(beta2, t_user);
+        bc1_item1 = 1. - pow(beta1, t_item1); bc2_item1 = 1. - pow(beta2, t_item1);
+        bc1_item2 = 1. - pow(beta1, t_item2); bc2_item2 = 1. - pow(beta2, t_item2);
+      }
+
+      double *mU = state.mU, *mV = state.mV;
+      for(int k=0; k<model.rank; k++) {
+        double user_grad = cg * (s1 * item1_vec[k] - s2 * item2_vec[k]);
+        double item_grad = cg * su * user_vec[k];
+
+        double user_dir  = adaptive_dir(user_grad,  &state.gU[offset_user+k],  (mU != NULL) ? &mU[offset_user+k]  : NULL, bc1_user,  bc2_user);
+        double item1_dir = adaptive_dir(item_grad,  &state.gV[offset_item1+k], (mV != NULL) ? &mV[offset_item1+k] : NULL, bc1_item1, bc2_item1);
+        double item2_dir = adaptive_dir(-item_grad, &state.gV[offset_item2+k], (mV != NULL) ? &mV[offset_item2+k] : NULL, bc1_item2, bc2_item2);
+
+        user_vec[k]  -= step_user  * user_dir;
+        item1_vec[k] -= step_item1 * item1_dir;
+        item2_vec[k] -= step_item2 * item2_dir;
+      }
     }
+
+    scale_user  = su_new;
+    scale_item1 = s1_new;
+    scale_item2 = s2_new;
   }
 
   return true;
 }
 
+// comparison counts, row scales and optimizer state used by sgd_step
+void SolverSGD::prepare(Problem& prob, Model& model) {
+  n_comps_by_user.assign(n_users,0);
+  n_comps_by_item.assign(n_items,0);
+  for(int i=0; i<n_train_comps; ++i) {
+    ++n_comps_by_user[prob.train[i].user_id];
+    ++n_comps_by_item[prob.train[i].item1_id];
+    ++n_comps_by_item[prob.train[i].item2_id];
+  } 
+
+  scale_U.assign(n_users, 1.);
+  scale_V.assign(n_items, 1.);
+
+  if (stepsize_option != STEP_SCHEDULE) state.allocate(n_users, n_items, model.rank, (stepsize_option == STEP_ADAM));
+
+  replicas.select(n_comps_by_item, n_hot_items, n_threads, model.rank, hot_merge);
+}
+
 void SolverSGD::solve(Problem& prob, Model& model, Evaluator* eval) { 
 
   n_users = prob.n_users;
   n_items = prob.n_items;
   n_train_comps = prob.n_train_comps;
 
-  n_comps_by_user.resize(n_users,0);
-  n_comps_by_item.resize(n_items,0);
-  for(int i=0; i<n_train_comps; ++i) {
-    ++n_comps_by_user[prob.train[i].user_id];
-    ++n_comps_by_item[prob.train[i].item1_id];
-    ++n_comps_by_item[prob.train[i].item2_id];
-  } 
+  use_objective(prob);
+  prepare(prob, model);
  
   double time = omp_get_wtime();
   initialize(prob, model, init_option); 
   time = omp_get_wtime() - time;
 
-  double f;
-  printf("0, %f, ", time);
-  f = prob.evaluate(model);
-  eval->evaluate(model);
-  printf("\n");
+  n_updates = 0;
+  trace.clear();
+  double f = report(0, time, prob, model, eval);
 
   int n_max_updates = n_train_comps/n_threads;
 
-  bool flag = false;
-
   for(int iter=0; iter<max_iter; ++iter) {
     double time_single_iter = omp_get_wtime();
-    #pragma omp parallel
+    long long n_skipped = 0;
+
+    #pragma omp parallel reduction(+:n_skipped)
     {
-      std::mt19937 gen(n_threads*iter+omp_get_thread_num());
-      std::uniform_int_distribution<int> randidx(0, n_train_comps-1);
+      int i_thread = omp_get_thread_num();
+      // implicit feedback rewrites the negatives of the drawn slots : every thread draws from its
+      // own range of comparisons, and skips a slot for which no negative was found
+      int idx_from = 0, idx_to = n_train_comps;
+      if (prob.implicit != NULL) {
+        idx_from = (long long)n_train_comps * i_thread / n_threads;
+        idx_to   = (long long)n_train_comps * (i_thread+1) / n_threads;
+      }
+
+      std::mt19937 gen(n_threads*iter+i_thread);
+      std::uniform_int_distribution<int> randidx(idx_from, idx_to-1);
+      UpcomingComparisons upcoming;
 
+      replicas.pull(i_thread, model.V);
       for(int n_updates=1; n_updates<n_max_updates; ++n_updates) {
-        int idx = randidx(gen);
-        double stepsize = alpha/(1.+beta*(double)((n_updates+n_max_updates*iter)*n_threads));
-        if (!sgd_step(model, prob.train[idx], prob.loss_option, prob.lambda, stepsize)) {
-          flag = true;
-          break;
+        int idx = upcoming.next(gen, randidx, prob.train, model, prefetch_batch);
+        int neg = (prob.implicit != NULL) ? prob.implicit->sample(prob.train[idx].user_id, gen) : 0;
+        if (neg >= 0) {
+          if (prob.implicit != NULL) prob.train[idx].item2_id = neg;
+          double stepsize = (stepsize_option == STEP_SCHEDULE) ? alpha/(1.+beta*(double)((n_updates+n_max_updates*iter)*n_threads)) : alpha;
+          // a non-finite prediction skips the update instead of aborting the whole solve
+          if (!sgd_step(model, prob.train[idx], loss_option, lambda, stepsize, prob.get_weight(idx), i_thread)) ++n_skipped;
         }
+        if (replicas.enabled() && (n_updates % hot_sync_every == 0)) replicas.sync(i_thread, model.V);
       }
+      replicas.push(i_thread, model.V);
     }
 
-    if (flag) break;
+    metrics.add_time("solve_epoch", omp_get_wtime() - time_single_iter);
+
+    double time_phase = omp_get_wtime();
+    fold_scales(model);
+    metrics.add_time("fold_scales", omp_get_wtime() - time_phase);
 
     time = time + (omp_get_wtime() - time_single_iter);
-    printf("%d, %f, ", iter+1, time);
-    f = prob.evaluate(model);
-    eval->evaluate(model);
-    printf("\n");
+
+    if (n_skipped > 0) {
+      fprintf(stderr, "WARNING : %lld updates skipped due to non-finite predictions in iteration %d\n", n_skipped, iter+1);
+      if (n_skipped >= (long long)(n_max_updates-1)*n_threads) break;
+    }
+
+    n_updates += (long long)(n_max_updates-1) * n_threads;
+    metrics.add_count("updates", (long long)(n_max_updates-1) * n_threads);
+    metrics.add_count("skipped_updates", n_skipped);
+    f = report(iter+1, time, prob, model, eval);
+    if (validation_stop(iter+1) || stop_requested) break;
     
   } 
+  restore_best(model);
 
+  state.de_allocate();
+  replicas.clear();
 }
 
 
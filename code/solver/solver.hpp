@@ -2,34 +2,215 @@
 #define __SOLVER_HPP__
 
 #include <stdlib.h>
+#include <vector>
+#include <functional>
 #include "../problem.hpp"
+#include "../implicit.hpp"
 #include "../model.hpp"
 #include "../evaluator.hpp"
+#include "../metrics.hpp"
+#include "../random.hpp"
+#include "../linalg.hpp"
+#include "../replicas.hpp"
 
 enum init_option_t {INIT_PREDETERMINED, INIT_RANDOM, INIT_SVD, INIT_ALLONES};
 
+// objective value and cumulative work after each reported (half-)iteration
+struct trace_point {
+  int       iter;
+  double    time;
+  double    f;
+  long long n_updates;
+
+  trace_point(int it, double t, double fv, long long nu): iter(it), time(t), f(fv), n_updates(nu) {}
+};
+
+// Random comparisons of one thread. With a paged model, the indices are drawn batch at a time
+// (the same sequence as drawing them one by one) and the user and item rows of a batch are
+// passed to the pager as prefetch hints before its first update.
+class UpcomingComparisons {
+  std::vector<int> idx, users, items;
+  int pos;
+
+  public:
+    UpcomingComparisons() : pos(0) {}
+    int next(std::mt19937&, std::uniform_int_distribution<int>&, const std::vector<comparison>&, Model&, int);
+};
+
+inline int UpcomingComparisons::next(std::mt19937& gen, std::uniform_int_distribution<int>& randidx,
+                                     const std::vector<comparison>& comps, Model& model, int batch) {
+  if (!model.is_paged()) return randidx(gen);
+
+  if (pos >= idx.size()) {
+    idx.resize(batch);
+    users.resize(batch);
+    items.resize(2*batch);
+    for(int b=0; b<batch; ++b) {
+      idx[b] = randidx(gen);
+      users[b]     = comps[idx[b]].user_id;
+      items[2*b]   = comps[idx[b]].item1_id;
+      items[2*b+1] = comps[idx[b]].item2_id;
+    }
+    model.prefetch_users(users.data(), batch);
+    model.prefetch_items(items.data(), 2*batch);
+    pos = 0;
+  }
+  return idx[pos++];
+}
+
 class Solver {
 
 protected:
   int             n_users, n_items, n_train_comps;
 
   init_option_t   init_option;
+  unsigned        init_seed;
   int             max_iter;
 
   int             n_threads;
 
+  long long       n_updates;
+
+  // objective of the current solve, taken from the Problem unless set by set_objective
+  // (several solvers with different objectives can then share one Problem)
+  loss_option_t   loss_option;
+  double          lambda;
+  bool            objective_set;
+
+  bool            verbose;            // print the progress table
+
+  // stopping rules : relative objective decrease below tol, or no improvement of the
+  // validation error (if the problem has a validation set) for patience outer iterations
+  double          tol;
+  int             patience;
+
+  // per-thread replicas of the most compared item rows (SolverSGD, V-step of SolverAltSVM),
+  // merged into the shared rows every hot_sync_every updates of a thread
+  int             n_hot_items;
+  int             hot_sync_every;
+  merge_option_t  hot_merge;
+  HotItemReplicas replicas;
+
+  // comparisons drawn ahead per prefetch hint when the model is paged
+  int             prefetch_batch;
+
+  // called by report with (iteration, time, objective); returning false stops the solve at the
+  // next stopping-rule check
+  std::function<bool(int, double, double)> progress;
+  bool                                     stop_requested;
+
+  // model with the lowest validation error so far
+  double               best_validation;
+  int                  best_iter;
+  std::vector<double>  best_U, best_V;
+
+  void use_objective(const Problem& prob) { if (!objective_set) { loss_option = prob.loss_option; lambda = prob.lambda; } }
   void initialize(Problem&, Model&, init_option_t);
+  void initialize_svd(Problem&, Model&);
+  double report(int, double, Problem&, Model&, Evaluator*);
+  virtual double objective(Problem& prob, Model& model) { return prob.evaluate(model, loss_option, lambda); }
+  long long count_nonzeros(const double*, int);
+
+  bool converged(double f_old, double f) const { return stop_requested || ((f_old - f) / f_old < tol); }
+  bool validation_stop(int iter) const { return (patience > 0) && (best_iter >= 0) && (iter - best_iter >= patience); }
+  void restore_best(Model&);
 
 public:
+  std::vector<trace_point> trace;
+
   Solver() {}
   Solver(init_option_t init, int m_it, int n_th) : n_users(0), n_items(0), n_train_comps(0), 
-                                                   init_option(init), max_iter(m_it), n_threads(n_th) {}
+                                                   init_option(init), init_seed(1), max_iter(m_it), n_threads(n_th), n_updates(0), 
+                                                   loss_option(L2_HINGE), lambda(0.), objective_set(false), verbose(true), 
+                                                   tol(1e-5), patience(0), n_hot_items(0), hot_sync_every(1000), hot_merge(MERGE_SUM),
+                                                   prefetch_batch(512), stop_requested(false), best_validation(0.), best_iter(-1) {}
+  virtual ~Solver() {}
   virtual void solve(Problem&, Model&, Evaluator* eval) = 0; 
 
+  void set_stopping(double t, int p) { tol = t; patience = p; }
+  void set_objective(loss_option_t l, double lam) { loss_option = l; lambda = lam; objective_set = true; }
+  void set_verbose(bool v) { verbose = v; }
+  void set_init(init_option_t init) { init_option = init; }
+  void set_seed(unsigned seed) { init_seed = seed; }
+  void set_hot_items(int n, int every, merge_option_t merge) { n_hot_items = n; hot_sync_every = std::max(every, 1); hot_merge = merge; }
+  void set_prefetch_batch(int b) { prefetch_batch = std::max(b, 1); }
+  void set_progress(const std::function<bool(int, double, double)>& p) { progress = p; }
+
 };
 
+// print one line of the progress table, emit the metrics of the iteration and return the objective value
+double Solver::report(int iter, double time, Problem& prob, Model& model, Evaluator* eval) {
+  if (verbose) printf("%d, %f, ", iter, time);
+
+  double f;
+  {
+    ScopedTimer timer("objective");
+    f = objective(prob, model);
+  }
+
+  double validation = 0.;
+  if (!prob.validation.empty()) {
+    ScopedTimer timer("validation");
+    validation = prob.validation_error(model);
+    if (verbose) printf("%f, ", validation);
+
+    if (trace.empty()) best_iter = -1;
+    if ((best_iter < 0) || (validation < best_validation)) {
+      best_validation = validation;
+      best_iter = iter;
+      best_U.assign(model.U, model.U + (long long)model.n_users * model.rank);
+      best_V.assign(model.V, model.V + (long long)model.n_items * model.rank);
+    }
+  }
+  if (eval != NULL) {
+    ScopedTimer timer("evaluate");
+    eval->evaluate(model);
+  }
+  if (verbose) printf("\n");
+
+  if (metrics.enabled()) {
+    // throughput over the training time since the previous report
+    double    time_prev      = (trace.size() > 0) ? trace.back().time : 0.;
+    long long n_updates_prev = (trace.size() > 0) ? trace.back().n_updates : 0;
+
+    std::vector<std::pair<std::string, double> > fields;
+    fields.push_back(std::make_pair("iter", (double)iter));
+    fields.push_back(std::make_pair("time", time));
+    fields.push_back(std::make_pair("objective", f));
+    if (!prob.validation.empty()) fields.push_back(std::make_pair("validation_error", validation));
+    fields.push_back(std::make_pair("updates_per_sec", (time > time_prev) ? (double)(n_updates - n_updates_prev) / (time - time_prev) : 0.));
+    if (eval != NULL) fields.insert(fields.end(), eval->results.begin(), eval->results.end());
+    metrics.emit("iteration", fields);
+  }
+
+  if (trace.empty()) stop_requested = false;
+  trace.push_back(trace_point(iter, time, f, n_updates));
+  if (progress && !progress(iter, time, f)) stop_requested = true;
+
+  return f;
+}
+
+// copy the snapshot with the lowest validation error back into the model
+void Solver::restore_best(Model& model) {
+  if (best_iter < 0) return;
+  if (verbose) printf("best validation error %f at iteration %d\n", best_validation, best_iter);
+  std::copy(best_U.begin(), best_U.end(), model.U);
+  std::copy(best_V.begin(), best_V.end(), model.V);
+  std::vector<double>().swap(best_U);
+  std::vector<double>().swap(best_V);
+}
+
+long long Solver::count_nonzeros(const double *alpha, int n) {
+  long long nnz = 0;
+  #pragma omp parallel for reduction(+:nnz)
+  for(int i=0; i<n; ++i) if (alpha[i] != 0.) ++nnz;
+  return nnz;
+}
+
 void Solver::initialize(Problem& prob, Model& model, init_option_t option) {
 
+  ScopedTimer timer("init");
+
   switch(option) {
     case INIT_PREDETERMINED:
 
@@ -37,25 +218,127 @@ void Solver::initialize(Problem& prob, Model& model, init_option_t option) {
 
     case INIT_ALLONES:
 
-    for(int i=0; i<n_users*model.rank; i++) model.U[i] = 1./sqrt((double)model.rank);
+    for(long long i=0; i<(long long)n_users*model.rank; i++) model.U[i] = 1./sqrt((double)model.rank);
     memset(model.V, 0, sizeof(double) * n_items * model.rank);
     break;
 
     case INIT_RANDOM:
   
-    srand(time(NULL)); 
-    for(int i=0; i<n_users*model.rank; i++) model.U[i] = (double)rand() / (double)RAND_MAX / sqrt((double)model.rank);
-    for(int i=0; i<n_items*model.rank; i++) model.V[i] = (double)rand() / (double)RAND_MAX / sqrt((double)model.rank);
+    // uniform in [0, 1/sqrt(rank)), row by row from the counter-based generator
+    #pragma omp parallel for schedule(static,1024)
+    for(int uid=0; uid<n_users; ++uid) {
+      double *u = &model.U[(long long)uid * model.rank];
+      philox_uniform(init_seed, 0, uid, u, model.rank);
+      for(int k=0; k<model.rank; ++k) u[k] /= sqrt((double)model.rank);
+    }
+    #pragma omp parallel for schedule(static,1024)
+    for(int iid=0; iid<n_items; ++iid) {
+      double *v = &model.V[(long long)iid * model.rank];
+      philox_uniform(init_seed, 1, iid, v, model.rank);
+      for(int k=0; k<model.rank; ++k) v[k] /= sqrt((double)model.rank);
+    }
     break;
  
     case INIT_SVD:
-    /* NOT IMPLEMENTED */
-    srand(time(NULL)); 
-    for(int i=0; i<n_users*model.rank; i++) model.U[i] = (double)rand() / (double)RAND_MAX / sqrt((double)model.rank);
-    for(int i=0; i<n_items*model.rank; i++) model.V[i] = (double)rand() / (double)RAND_MAX / sqrt((double)model.rank);
 
+    initialize(prob, model, INIT_RANDOM);
+    initialize_svd(prob, model);
+
+  }
+
+}
+
+// Randomized truncated SVD (Halko, Martinsson and Tropp, 2011) of the n_users x n_items
+// comparison-difference matrix D, D[u][i] = (weighted) #wins - #losses of item i for user u.
+// U = U_svd S^1/2 and V = V_svd S^1/2 on the leading singular triplets; columns with a
+// vanishing singular value keep their random initialization.
+void Solver::initialize_svd(Problem& prob, Model& model) {
+
+  const int n_oversample = 10, n_power_iter = 2;
+  int rank = model.rank;
+  int l = std::min(rank + n_oversample, std::min(n_users, n_items));
+  if (l <= 0) return;
+
+  std::vector<double> Y((long long)n_users * l), Z((long long)n_items * l);
+
+  // Y = D Z, comparisons are grouped by user
+  auto multiply_D = [&]() {
+    #pragma omp parallel for schedule(dynamic,64)
+    for(int uid=0; uid<n_users; ++uid) {
+      double *y = &Y[(long long)uid * l];
+      for(int p=0; p<l; ++p) y[p] = 0.;
+      for(int c=prob.tridx[uid]; c<prob.tridx[uid+1]; ++c) {
+        double w = prob.get_weight(c);
+        const double *z1 = &Z[(long long)prob.train[c].item1_id * l];
+        const double *z2 = &Z[(long long)prob.train[c].item2_id * l];
+        for(int p=0; p<l; ++p) y[p] += w * (z1[p] - z2[p]);
+      }
+    }
+  };
+
+  // Z = D^T Y, item by item over the comparisons of the item in a fixed order (no atomics, so
+  // the result does not depend on the number of threads)
+  ItemComparisons index;
+  index.build(prob);
+  auto multiply_Dt = [&]() {
+    #pragma omp parallel for schedule(dynamic,64)
+    for(int iid=0; iid<n_items; ++iid) {
+      double *z = &Z[(long long)iid * l];
+      for(int p=0; p<l; ++p) z[p] = 0.;
+      for(long long e=index.ptr[iid]; e<index.ptr[iid+1]; ++e) {
+        int c = index.comps[e];
+        double w = (prob.train[c].item1_id == iid) ? prob.get_weight(c) : -prob.get_weight(c);
+        const double *y = &Y[(long long)prob.train[c].user_id * l];
+        for(int p=0; p<l; ++p) z[p] += w * y[p];
+      }
+    }
+  };
+
+  // Gaussian test matrix
+  #pragma omp parallel for schedule(static,1024)
+  for(int iid=0; iid<n_items; ++iid) philox_normal(init_seed, 2, iid, &Z[(long long)iid * l], l);
+
+  // range of D by subspace iteration : Y = orth(D (D^T D)^q Z)
+  multiply_D();
+  for(int it=0; it<n_power_iter; ++it) {
+    orthonormalize_columns(Y.data(), n_users, l);
+    multiply_Dt();
+    orthonormalize_columns(Z.data(), n_items, l);
+    multiply_D();
+  }
+  orthonormalize_columns(Y.data(), n_users, l);
+
+  // D ~ Y B with B^T = D^T Y = Z; the SVD of B comes from the eigen-decomposition of B B^T = Z^T Z
+  multiply_Dt();
+  std::vector<double> G(l*l), s(l), W(l*l);
+  gram(Z.data(), Z.data(), n_items, l, G.data());
+  symmetric_eigen(G.data(), l, s.data(), W.data());
+
+  int n_used = 0;
+  for(int k=0; k<std::min(rank, l); ++k) {
+    if (s[k] <= 1e-12 * std::max(s[0], 1e-300)) break;
+    ++n_used;
+  }
+
+  // U[:,k] = Y W[:,k] sigma_k^1/2, V[:,k] = Z W[:,k] sigma_k^-1/2
+  #pragma omp parallel for schedule(static,1024)
+  for(int uid=0; uid<n_users; ++uid) {
+    for(int k=0; k<n_used; ++k) {
+      double x = 0.;
+      for(int p=0; p<l; ++p) x += Y[(long long)uid * l + p] * W[p*l+k];
+      model.U[(long long)uid * rank + k] = x * pow(s[k], .25);
+    }
+  }
+  #pragma omp parallel for schedule(static,1024)
+  for(int iid=0; iid<n_items; ++iid) {
+    for(int k=0; k<n_used; ++k) {
+      double x = 0.;
+      for(int p=0; p<l; ++p) x += Z[(long long)iid * l + p] * W[p*l+k];
+      model.V[(long long)iid * rank + k] = x * pow(s[k], -.25);
+    }
   }
 
+  metrics.add_count("svd_vectors", n_used);
 }
 
 #endif
@@ -0,0 +1,87 @@
+#ifndef __SYNTHETIC_HPP__
+#define __SYNTHETIC_HPP__
+
+#include <random>
+#include <omp.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "elements.hpp"
+#include "problem.hpp"
+
+// Synthetic pairwise comparisons from a planted low-rank model.
+// Both the number of comparisons per user and the item popularity follow power laws.
+struct synthetic_option {
+  int      n_users        = 10000;
+  int      n_items        = 5000;
+  int      comps_per_user = 100;    // average number of comparisons per user
+  int      rank           = 10;     // rank of the planted model
+  double   user_exponent  = .5;     // n_comps(user u) ~ (u+1)^-user_exponent
+  double   item_exponent  = 1.;     // P(item i) ~ (i+1)^-item_exponent
+  unsigned seed           = 1;
+};
+
+void generate_comparisons(const synthetic_option& opt, Problem& prob) {
+
+  int rank = opt.rank;
+
+  // planted model
+  std::vector<double> U((long long)opt.n_users * rank), V((long long)opt.n_items * rank);
+  std::mt19937 gen(opt.seed);
+  std::normal_distribution<double> normal(0., 1.);
+  for(int i=0; i<U.size(); ++i) U[i] = normal(gen);
+  for(int i=0; i<V.size(); ++i) V[i] = normal(gen);
+
+  // power-law comparison counts per user
+  std::vector<double> w(opt.n_users);
+  double w_sum = 0.;
+  for(int uid=0; uid<opt.n_users; ++uid) { w[uid] = pow((double)(uid+1), -opt.user_exponent); w_sum += w[uid]; }
+
+  prob.tridx.resize(opt.n_users+1);
+  prob.tridx[0] = 0;
+  for(int uid=0; uid<opt.n_users; ++uid) {
+    int n_comps_user = std::max(1, (int)round((double)opt.comps_per_user * (double)opt.n_users * w[uid] / w_sum));
+    prob.tridx[uid+1] = prob.tridx[uid] + n_comps_user;
+  }
+
+  // power-law item popularity
+  std::vector<double> cdf(opt.n_items);
+  double c = 0.;
+  for(int iid=0; iid<opt.n_items; ++iid) { c += pow((double)(iid+1), -opt.item_exponent); cdf[iid] = c; }
+  for(int iid=0; iid<opt.n_items; ++iid) cdf[iid] /= c;
+
+  prob.train.resize(prob.tridx[opt.n_users]);
+
+  #pragma omp parallel for schedule(dynamic,64)
+  for(int uid=0; uid<opt.n_users; ++uid) {
+    std::mt19937 gen_user(opt.seed + 1 + uid);
+    std::uniform_real_distribution<double> unif(0., 1.);
+
+    for(int i=prob.tridx[uid]; i<prob.tridx[uid+1]; ++i) {
+      int i1, i2;
+      do {
+        i1 = std::min((int)(std::lower_bound(cdf.begin(), cdf.end(), unif(gen_user)) - cdf.begin()), opt.n_items-1);
+        i2 = std::min((int)(std::lower_bound(cdf.begin(), cdf.end(), unif(gen_user)) - cdf.begin()), opt.n_items-1);
+      } while ((i1 == i2) && (opt.n_items > 1));
+
+      double s1 = 0., s2 = 0.;
+      for(int k=0; k<rank; ++k) {
+        s1 += U[(long long)uid*rank+k] * V[(long long)i1*rank+k];
+        s2 += U[(long long)uid*rank+k] * V[(long long)i2*rank+k];
+      }
+      if (s1 < s2) std::swap(i1, i2);
+
+      prob.train[i] = comparison(uid, i1, i2, 1);
+    }
+
+    std::sort(prob.train.begin()+prob.tridx[uid], prob.train.begin()+prob.tridx[uid+1], comp_userwise);
+  }
+
+  prob.n_users       = opt.n_users;
+  prob.n_items       = opt.n_items;
+  prob.n_train_comps = prob.train.size();
+}
+
+#endif